@@ -0,0 +1,96 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "raytracer/texture.h"
+
+// Times texture lookups on one thread, for random (s, t) and for the coherent walk of scanlines over a sphere's
+// texture mapping, nearest and bilinear. Textures are kept in memory, and then streamed through a tile cache holding
+// a quarter of them.
+//
+// Usage: texturebench [size] [lookups]
+
+static std::vector<glm::vec2> randomCoordinates(int count) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> coordinate(0.0f, 1.0f);
+    std::vector<glm::vec2> coordinates(count);
+    for (glm::vec2& st : coordinates)
+        st = glm::vec2(coordinate(rng), coordinate(rng));
+    return coordinates;
+}
+
+// The (s, t) seen by the pixels of an image of a slightly tilted sphere filling the frame, row by row
+static std::vector<glm::vec2> sphereScanlines(int count) {
+    const int width = 2000;
+    const int height = count / width;
+    std::vector<glm::vec2> coordinates;
+    coordinates.reserve(count);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float px = 2.0f * x / width - 1.0f;
+            float py = 2.0f * y / height - 1.0f;
+            float r2 = px * px + py * py;
+            float pz = r2 < 1.0f ? std::sqrt(1.0f - r2) : 0.0f;
+            float theta = std::atan2(pz, px + 0.3f * py);
+            float s = theta < 0 ? -theta / (2.0f * M_PI) : 1.0f - theta / (2.0f * M_PI);
+            float t = std::asin(std::clamp(py * 0.9f + px * 0.1f, -1.0f, 1.0f)) / M_PI + 0.5f;
+            coordinates.push_back(glm::vec2(s, t));
+        }
+    }
+    return coordinates;
+}
+
+static void run(const char* texture, const char* access, const Texture& tex, const std::vector<glm::vec2>& coordinates) {
+    for (bool filtered : {false, true}) {
+        glm::vec4 sum(0.0f);
+        auto start = std::chrono::steady_clock::now();
+        for (const glm::vec2& st : coordinates)
+            sum += filtered ? tex.sampleTrilinear(st.x, st.y, 0.0f) : tex.sampleNearest(st.x, st.y);
+        double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        // The sum is printed so the lookups can't be optimized away
+        std::printf("%-9s %-17s %-8s %7.1f ns/lookup  (%g)\n", texture, access, filtered ? "bilinear" : "nearest",
+                    elapsed / coordinates.size(), sum.x + sum.y + sum.z);
+    }
+}
+
+int main(int argc, char** argv) {
+    int size = argc > 1 ? std::atoi(argv[1]) : 4096;
+    int lookups = argc > 2 ? std::atoi(argv[2]) : 4000000;
+
+    std::vector<RGBA> image(size * size);
+    for (int i = 0; i < size * size; i++)
+        image[i] = RGBA{(std::uint8_t)i, (std::uint8_t)(i >> 8), (std::uint8_t)(i >> 16)};
+    Texture texture(size, size, image);
+
+    std::vector<glm::vec2> random = randomCoordinates(lookups);
+    std::vector<glm::vec2> coherent = sphereScanlines(lookups);
+
+    std::printf("%dx%d texture, %d lookups\n", size, size, lookups);
+    run("in memory", "random", texture, random);
+    run("in memory", "sphere scanlines", texture, coherent);
+
+    const std::string path = (std::filesystem::temp_directory_path() / "texturebench.tex").string();
+    std::size_t bytes = (std::size_t)size * size * sizeof(RGBA);
+    TextureTileCache tiles(bytes / 4);
+    std::unique_ptr<Texture> streamed;
+    if (texture.save(path, 0))
+        streamed = Texture::open(path, 0, &tiles);
+    if (!streamed) {
+        std::printf("Could not stream the texture from %s\n", path.c_str());
+        return EXIT_FAILURE;
+    }
+    run("streamed", "random", *streamed, random);
+    run("streamed", "sphere scanlines", *streamed, coherent);
+
+    TextureTileStats stats = tiles.stats();
+    std::printf("Tile cache: %llu hits, %llu misses\n", (unsigned long long)stats.hits,
+                (unsigned long long)stats.misses);
+    streamed.reset();
+    std::filesystem::remove(path);
+    return EXIT_SUCCESS;
+}
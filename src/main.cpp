@@ -6,7 +6,9 @@
 #include <iostream>
 #include "motion/motion.h"
 #include "utils/sceneparser.h"
+#include "utils/compiledscene.h"
 #include "utils/raymarchsettings.h"
+#include "utils/fractalsettings.h"
 #include "raytracer/raytracer.h"
 #include "raytracer/raytracescene.h"
 
@@ -27,6 +29,19 @@ void parseRayMarchSettings(QSettings& settings) {
     rayMarchSettings.mergeFactor = settings.value("Raymarch/merge-factor").toFloat();
     rayMarchSettings.polyExponent = settings.value("Raymarch/polynomial-exponent").toInt();
     rayMarchSettings.multipleMerge = settings.value("Raymarch/multiple-merge").toBool();
+    rayMarchSettings.hybrid = settings.value("Raymarch/hybrid", true).toBool();
+    rayMarchSettings.temporalReprojection = settings.value("Raymarch/temporal-reprojection", false).toBool();
+}
+
+void parseFractalSettings(QSettings& settings) {
+    fractalSettings.lodEnabled = settings.value("Fractal/lod", true).toBool();
+    fractalSettings.lodScale = settings.value("Fractal/lod-scale", 1.0f).toFloat();
+    fractalSettings.mandelbulbIterations = settings.value("Fractal/mandelbulb-iterations", 20).toInt();
+    fractalSettings.mandelboxIterations = settings.value("Fractal/mandelbox-iterations", 30).toInt();
+    fractalSettings.serpinskiIterations = settings.value("Fractal/serpinski-iterations", 15).toInt();
+    fractalSettings.volumeCacheEnabled = settings.value("Fractal/volume-cache", false).toBool();
+    fractalSettings.volumeCacheDir = settings.value("Fractal/volume-cache-dir", "sdfcache").toString().toStdString();
+    fractalSettings.volumeResolution = settings.value("Fractal/volume-resolution", 256).toInt();
 }
 
 int main(int argc, char *argv[])
@@ -36,6 +51,9 @@ int main(int argc, char *argv[])
     QCommandLineParser parser;
     parser.addHelpOption();
     parser.addPositionalArgument("config", "Path of the config file.");
+    QCommandLineOption compileOption("compile", "Compile the config's scene into a binary scene file at <path>, which "
+                                     "loads without parsing when given as the scene, then exit.", "path");
+    parser.addOption(compileOption);
     parser.process(a);
 
     auto positionalArgs = parser.positionalArguments();
@@ -49,6 +67,17 @@ int main(int argc, char *argv[])
     QString iScenePath = settings.value("IO/scene").toString();
     QString oImagePath = settings.value("IO/output").toString();
 
+    if (parser.isSet(compileOption)) {
+        QString compiledPath = parser.value(compileOption);
+        if (!CompiledScene::compile(iScenePath.toStdString(), compiledPath.toStdString())) {
+            std::cerr << "Error compiling scene: \"" << iScenePath.toStdString() << "\"" << std::endl;
+            a.exit(1);
+            return 1;
+        }
+        std::cout << "Compiled scene written to \"" << compiledPath.toStdString() << "\"" << std::endl;
+        return 0;
+    }
+
     RenderData metaData;
     bool success = SceneParser::parse(iScenePath.toStdString(), metaData);
 
@@ -79,13 +108,22 @@ int main(int argc, char *argv[])
     rtConfig.enableSuperSample   = settings.value("Feature/super-sample").toBool();
     rtConfig.enableAcceleration  = settings.value("Feature/acceleration").toBool();
     rtConfig.enableDepthOfField  = settings.value("Feature/depthoffield").toBool();
+    rtConfig.enableShadowMaps    = settings.value("Feature/shadow-maps", false).toBool();
+    rtConfig.shadowMapResolution = settings.value("Feature/shadow-map-resolution", 1024).toInt();
+    rtConfig.reflectionThreshold = settings.value("Feature/reflection-threshold", 1.0f / 256.0f).toFloat();
+    rtConfig.enableRussianRoulette = settings.value("Feature/russian-roulette", false).toBool();
+    rtConfig.enableAreaLightProbes = settings.value("Feature/area-light-probes", false).toBool();
+    rtConfig.enableLightTree     = settings.value("Feature/light-tree", false).toBool();
+    rtConfig.textureBudgetMB     = settings.value("Feature/texture-budget-mb", 0).toInt();
+    rtConfig.textureCacheDir     = settings.value("Feature/texture-cache-dir", "texcache").toString().toStdString();
 
 
     parseMotionSettings(settings, motionSettings);
     parseRayMarchSettings(settings);
+    parseFractalSettings(settings);
 
     RayTracer raytracer{ rtConfig };
-    RayTraceScene rtScene{ width, height, metaData };
+    RayTraceScene rtScene{ width, height, std::move(metaData) };
 
     if(motionSettings.enabled){
         // Handle the motion generation
@@ -112,6 +150,7 @@ int main(int argc, char *argv[])
             std::cerr << "Error: failed to save image to \"" << oImagePath.toStdString() << "\"" << std::endl;
         }
     }
+    raytracer.printStats();
 
     a.exit();
     return 0;
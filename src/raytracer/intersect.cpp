@@ -37,15 +37,49 @@ std::pair<std::optional<float>, std::optional<float>> solveQuadratic(float a, fl
     };
 }
 
+bool boundingSphereInterval(const Shape* shape, const Ray& ray, float padding, float& tEnter, float& tExit){
+    float radius = shape->getWorldBoundRadius() + padding;
+    if(std::isinf(radius)){
+        tEnter = -std::numeric_limits<float>::infinity();
+        tExit = std::numeric_limits<float>::infinity();
+        return true;
+    }
 
-std::optional<Intersect> intersect(const RayTraceScene& scene, const Ray& ray){
-    // Check if we want to use raymarching instead
-    if(rayMarchSettings.enabled)
-        return intersectMarch(scene, ray);
+    glm::vec3 oc = glm::vec3(ray.p) - glm::vec3(shape->getWorldBoundCenter());
+    glm::vec3 d = ray.d;
+    float a = glm::dot(d, d);
+    float b = glm::dot(oc, d);
+    float c = glm::dot(oc, oc) - radius * radius;
+    float disc = b * b - a * c;
+    if(disc < 0)
+        return false;
+
+    float root = std::sqrt(disc);
+    tEnter = (-b - root) / a;
+    tExit = (-b + root) / a;
+    return true;
+}
 
-    std::optional<Intersect> intersection = std::nullopt;
-    const std::vector<Shape*>& shapes = scene.getShapes();
+std::optional<Intersect> intersect(const RayTraceScene& scene, const Ray& ray, float marchStart){
+    if(!rayMarchSettings.enabled)
+        return intersectAnalytic(scene.getShapes(), ray);
+
+    // Hybrid: intersect everything we can in closed form, and only march the shapes that need it,
+    // no further than the closest analytic hit.
+    std::optional<Intersect> intersection = intersectAnalytic(scene.getAnalyticShapes(), ray);
+    const std::vector<Shape*>& marchedShapes = scene.getMarchedShapes();
+    if(!marchedShapes.empty()){
+        float maxT = intersection.has_value() ? intersection.value().t : MAX_RAYMARCH_DISTANCE;
+        std::optional<Intersect> marchIntersection = intersectMarch(scene, marchedShapes, ray, maxT, marchStart);
+        if(marchIntersection.has_value())
+            replaceIntercept(intersection, marchIntersection.value());
+    }
 
+    return intersection;
+}
+
+std::optional<Intersect> intersectAnalytic(const std::vector<Shape*>& shapes, const Ray& ray){
+    std::optional<Intersect> intersection = std::nullopt;
 
     for(const Shape* shape : shapes){
         Ray objectRay = Ray{shape->m_ctm_inverse * ray.p, shape->m_ctm_inverse * ray.d};
@@ -60,32 +94,136 @@ std::optional<Intersect> intersect(const RayTraceScene& scene, const Ray& ray){
     return intersection;
 }
 
-std::optional<Intersect> intersectMarch(const RayTraceScene& shapes, const Ray& worldSpaceRay) {
+/**
+ * Per-ray active set: only shapes whose bounding sphere the ray still has to pass through. When smooth merging,
+ * the spheres are padded by the merge factor, since a shape can blend into a surface up to that far away from it.
+ * Returns the ray parameter at which the ray enters the first bounding sphere. Replaces what activeShapes and
+ * activeExits held, keeping their capacity, so callers can reuse them from ray to ray.
+ */
+static float gatherActiveShapes(const std::vector<Shape*>& shapes, const Ray& worldSpaceRay,
+                                std::vector<Shape*>& activeShapes, std::vector<float>& activeExits) {
+    activeShapes.clear();
+    activeExits.clear();
+    const float padding = rayMarchSettings.smoothMergeEnabled ? rayMarchSettings.mergeFactor : 0.0f;
+    float firstEnter = std::numeric_limits<float>::infinity();
+    for (Shape* shape : shapes) {
+        float tEnter, tExit;
+        if (!boundingSphereInterval(shape, worldSpaceRay, padding, tEnter, tExit) || tExit < 0)
+            continue;
+        activeShapes.push_back(shape);
+        activeExits.push_back(tExit);
+        firstEnter = std::min(firstEnter, tEnter);
+    }
+    return firstEnter;
+}
+
+// Once the ray has left a shape's bounding sphere it can never come back into it,
+// so that shape can not be hit (or blended with) for the rest of the march.
+static void pruneActiveShapes(float t, std::vector<Shape*>& activeShapes, std::vector<float>& activeExits) {
+    int kept = 0;
+    for (int i = 0; i < activeShapes.size(); i++) {
+        if (activeExits[i] < t)
+            continue;
+        activeShapes[kept] = activeShapes[i];
+        activeExits[kept] = activeExits[i];
+        kept++;
+    }
+    activeShapes.resize(kept);
+    activeExits.resize(kept);
+}
+
+std::optional<Intersect> intersectMarch(const RayTraceScene& scene, const std::vector<Shape*>& shapes, const Ray& worldSpaceRay, float maxT, float startT) {
     std::optional<Intersect> intersection; // in WORLD SPACE
 
-    float distTraveledAlongRay = 0;
-    for (int currStep = 0; currStep < MAX_NUM_RAYMARCH_STEPS; currStep++) {
+    // Kept per thread, so marching doesn't allocate once they've grown to the scene's size. Nothing marches again
+    // while a march is in progress.
+    thread_local std::vector<Shape*> activeShapes;
+    thread_local std::vector<float> activeExits;
+    float firstEnter = gatherActiveShapes(shapes, worldSpaceRay, activeShapes, activeExits);
+
+    // Nothing can be hit before the ray reaches the first bounding sphere
+    float distTraveledAlongRay = std::max(0.0f, firstEnter);
+    // A start hint can only skip space the caller knows to be empty. If it lands on (or in) a surface, the hint
+    // is stale, so march from the beginning instead.
+    if (startT > distTraveledAlongRay && !activeShapes.empty()) {
+        SDFResult startSDF = sceneSDF(worldSpaceRay.evaluate(startT), worldSpaceRay.d, activeShapes, scene.pixelFootprint(startT));
+        if (startSDF.sceneSDFVal > MARCH_EPSILON) {
+            distTraveledAlongRay = startT;
+            pruneActiveShapes(distTraveledAlongRay, activeShapes, activeExits);
+        }
+    }
+    for (int currStep = 0; currStep < MAX_NUM_RAYMARCH_STEPS && !activeShapes.empty(); currStep++) {
 
         glm::vec4 currPointAlongRay = worldSpaceRay.p + distTraveledAlongRay*worldSpaceRay.d;
+        // Detail smaller than a pixel at this distance can't be seen, so the SDFs don't need to resolve it
+        float footprint = scene.pixelFootprint(distTraveledAlongRay);
         // get dist to nearest surface point in scene
-        SDFResult sdf = sceneSDF(currPointAlongRay, shapes);
+        SDFResult sdf = sceneSDF(currPointAlongRay, worldSpaceRay.d, activeShapes, footprint);
 
 
         // hit: exit if we are below a distance threshold to any surface in the scene
         if (sdf.sceneSDFVal <= MARCH_EPSILON) {
-            // record the intersection point and its normal
-            replaceIntercept(intersection, Intersect{sdf.intersectedShape, distTraveledAlongRay, worldSpaceNormal(currPointAlongRay, shapes)});
+            // record the intersection point and its normal, shading groups with the member that was hit. So do
+            // instances, unless they're blended, since a blend can't keep the instance each of its shapes is in.
+            PPShape& hit = sdf.intersectedShape;
+            hit.marched = true;
+            for (const Shape*& hitShape : hit.shapes) {
+                if (hitShape->isInstance() && hit.isPlural)
+                    continue;
+                const Shape* surface = hitShape->surfaceShape(currPointAlongRay);
+                if (hitShape->isInstance())
+                    hit.instance = hitShape;
+                else if (surface != hitShape && !hit.isPlural)
+                    hit.group = hitShape;
+                hitShape = surface;
+            }
+            replaceIntercept(intersection, Intersect{sdf.intersectedShape, distTraveledAlongRay, worldSpaceNormal(currPointAlongRay, shapes, footprint)});
             break;
         }
         // miss: exit if we have not intersected after the max march distance
-        if (distTraveledAlongRay > MAX_RAYMARCH_DISTANCE) {
+        if (distTraveledAlongRay > maxT) {
             break;
         }
 
         // take step along ray according to the sdf
         distTraveledAlongRay += sdf.sceneSDFVal;
-
+        pruneActiveShapes(distTraveledAlongRay, activeShapes, activeExits);
     }
 
     return intersection;
 }
+
+float softShadowMarch(const RayTraceScene& scene, const Ray& worldSpaceRay, float minT, float maxT, float softness) {
+    // Kept per thread, like intersectMarch's
+    thread_local std::vector<Shape*> activeShapes;
+    thread_local std::vector<float> activeExits;
+    float firstEnter = gatherActiveShapes(scene.getShapes(), worldSpaceRay, activeShapes, activeExits);
+
+    const float sharpness = 1.0f / softness;
+    float visibility = 1.0f;
+    float previousSDF = std::numeric_limits<float>::infinity();
+    float t = std::max(minT, firstEnter);
+    for (int currStep = 0; currStep < MAX_NUM_RAYMARCH_STEPS && t < maxT && !activeShapes.empty(); currStep++) {
+        float sdf = sceneSDF(worldSpaceRay.evaluate(t), activeShapes, scene.pixelFootprint(t)).sceneSDFVal;
+        if (sdf <= MARCH_EPSILON)
+            return 0.0f;
+
+        // The closest the ray came to the occluder between this sample and the previous one, estimated from the
+        // two distance spheres (Quilez), relative to how far along the ray that happened. Bounds that aren't exact
+        // distances can grow faster than the spheres allow, in which case only this sample is used.
+        float y = sdf * sdf / (2.0f * previousSDF);
+        if (y < sdf) {
+            float closest = std::sqrt(sdf * sdf - y * y);
+            visibility = std::min(visibility, sharpness * closest / std::max(MARCH_EPSILON, t - y));
+        } else {
+            visibility = std::min(visibility, sharpness * sdf / t);
+        }
+        previousSDF = sdf;
+
+        t += sdf;
+        pruneActiveShapes(t, activeShapes, activeExits);
+    }
+
+    visibility = std::clamp(visibility, 0.0f, 1.0f);
+    return visibility * visibility * (3.0f - 2.0f * visibility);
+}
@@ -11,17 +11,39 @@
 const static float PI = 3.14159265358979323846;
 
 /**
- * @brief intersect Finds the closest intersection between a ray and an object in the scene.
+ * @brief intersect Finds the closest intersection between a ray and an object in the scene. Marched shapes are
+ * only marched from marchStart on, which must be a distance along the ray with nothing in front of it.
  */
-std::optional<Intersect> intersect(const RayTraceScene& shapes, const Ray& ray);
+std::optional<Intersect> intersect(const RayTraceScene& shapes, const Ray& ray, float marchStart = 0.0f);
 
 /**
- * @brief intersectMarch same as intersect, but finds the intersection iteratively via ray marching
+ * @brief intersectAnalytic Finds the closest intersection between a ray and the given shapes, using each shape's
+ * closed form intersect.
  */
-std::optional<Intersect> intersectMarch(const RayTraceScene& shapes, const Ray& ray);
+std::optional<Intersect> intersectAnalytic(const std::vector<Shape*>& shapes, const Ray& ray);
+
+/**
+ * @brief intersectMarch same as intersectAnalytic, but finds the intersection iteratively via ray marching,
+ * giving up once the ray is further than maxT along. The scene's pixel footprint sets the level of detail.
+ * The march starts at startT, unless that point is already on or inside a surface.
+ */
+std::optional<Intersect> intersectMarch(const RayTraceScene& scene, const std::vector<Shape*>& shapes, const Ray& ray, float maxT, float startT = 0.0f);
+
+/**
+ * @brief softShadowMarch Marches a shadow ray (with a normalized direction) toward a light, and returns how
+ * much of the light gets through, from 0 (fully occluded) to 1. The penumbra is estimated from how close the
+ * ray passes to occluders relative to how far along it is, so a single march gives soft shadows. softness is
+ * the penumbra width per unit of distance to the occluder.
+ */
+float softShadowMarch(const RayTraceScene& scene, const Ray& ray, float minT, float maxT, float softness);
 
 // Utility functions
 bool isClose(float a, float b);
 void replaceIntercept(std::optional<Intersect>& current, Intersect replacement);
 glm::vec3 objectToWorldNormal(glm::vec3 objectNormal, const Shape* shape);
 std::pair<std::optional<float>, std::optional<float>> solveQuadratic(float a, float b, float c);
+/**
+ * @brief boundingSphereInterval Finds the ray parameters at which a world space ray enters and exits the
+ * shape's bounding sphere (grown by padding). Returns false if the ray misses the sphere entirely.
+ */
+bool boundingSphereInterval(const Shape* shape, const Ray& ray, float padding, float& tEnter, float& tExit);
@@ -1,5 +1,9 @@
+#include <array>
+#include <atomic>
+#include <cstring>
 #include "lighting.h"
 #include "glm/geometric.hpp"
+#include "utils/raymarchsettings.h"
 
 inline uint8_t clamp(float value){
     return 255 * std::min(1.0f, std::max(0.0f, value));
@@ -40,82 +44,170 @@ inline float fallout(float x, float inner, float outer){
     return -2 * std::pow(xp, 3) + 3 * std::pow(xp, 2);
 }
 
-const static float AREA_LIGHT_INTERVAL = 0.1;
+// Shadow rays start this far from the surface, so they don't hit the surface they start on
+const static float SHADOW_RAY_OFFSET = 0.01;
+// How far soft shadow marches toward directional lights go
+const static float MAX_SHADOW_DISTANCE = 1000.0;
 
-glm::vec4 getAreaLightIllumination(glm::vec4 point, const SceneLightData& light, RayTracer& raytracer, const RayTraceScene& scene){
-    float lightWidthRadius = light.width / 2;
-    float lightHeightRadius = light.height / 2;
-    glm::vec3 up {0, 1, 0};
-
-    glm::vec3 pos = light.pos;
-    glm::vec3 look = light.dir;
-
-    glm::mat4 translate = glm::mat4{
-      1,0,0,0,
-      0,1,0,0,
-      0,0,1,0,
-      -pos.x, -pos.y, -pos.z, 1
-    };
+bool usesSoftShadowMarch(const SceneLightData& light){
+    return rayMarchSettings.enabled && light.softness > 0;
+}
 
-    glm::vec3 w = -glm::normalize(look);
-    glm::vec3 v = glm::normalize(up - glm::dot(up, w) * w);
-    glm::vec3 u = glm::cross(v, w);
-    glm::mat4 rotate = glm::mat4{u.x, v.x, w.x, 0,
-                                 u.y, v.y, w.y, 0,
-                                 u.z, v.z, w.z, 0,
-                                 0, 0, 0, 1};
-    glm::mat4 lightSpaceCTM = glm::inverse(rotate * translate);
+static std::atomic<uint64_t> occluderCacheLookups = 0;
+static std::atomic<uint64_t> occluderCacheHits = 0;
+static std::atomic<uint64_t> droppedSecondaryRays = 0;
+
+/**
+ * The shape that last blocked a shadow ray toward each light, on this thread. Neighbouring shading points (and
+ * neighbouring samples on an area light) are usually blocked by the same shape, which is much cheaper to test on
+ * its own than the whole scene.
+ */
+struct OccluderCache {
+    int sceneId = -1;
+    std::vector<const Shape*> occluders; // Indexed by light
+};
+
+static OccluderCache& occluderCache(const RayTraceScene& scene){
+    thread_local OccluderCache cache;
+    // Shapes from other scenes may be gone
+    if(cache.sceneId != scene.id()){
+        cache.sceneId = scene.id();
+        cache.occluders.assign(scene.getLights().size(), nullptr);
+    }
+    return cache;
+}
 
-    float illuminationFactor = 0;
-    float numPoints = 0;
-    for(float widthOffset = -lightWidthRadius; widthOffset < lightWidthRadius; widthOffset += AREA_LIGHT_INTERVAL){
-        for(float heightOffset = -lightHeightRadius; heightOffset < lightHeightRadius; heightOffset += AREA_LIGHT_INTERVAL){
-            numPoints++;
-            // Compute the point on the light we want to trace to
-            glm::vec4 offset {0, widthOffset, heightOffset, 1};
+// Whether the ray hits shape (on its own) with minT <= t <= maxT
+static bool shapeOccludes(const Shape* shape, const Ray& ray, float minT, float maxT, const RayTraceScene& scene){
+    std::optional<Intersect> intersection;
+    if(rayMarchSettings.enabled && (!rayMarchSettings.hybrid || shape->requiresMarching())){
+        // intersectMarch only reads its shapes
+        thread_local std::vector<Shape*> shapes(1);
+        shapes[0] = const_cast<Shape*>(shape);
+        intersection = intersectMarch(scene, shapes, ray, std::min(maxT, MAX_SHADOW_DISTANCE));
+    } else {
+        std::optional<Intersect> shapeIntersection = shape->intersect(Ray{shape->m_ctm_inverse * ray.p, shape->m_ctm_inverse * ray.d});
+        if(shapeIntersection.has_value())
+            replaceIntercept(intersection, shapeIntersection.value());
+    }
+    return intersection.has_value() && intersection.value().t >= minT && intersection.value().t <= maxT;
+}
 
-            glm::vec4 lightPosition = lightSpaceCTM * offset;
+// Whether the closest hit along a shadow ray toward light lies between minT and maxT
+static bool shadowRayBlocked(const Ray& ray, float minT, float maxT, const SceneLightData& light, const RayTraceScene& scene){
+    const Shape*& cachedOccluder = occluderCache(scene).occluders[scene.getLightIndex(light)];
+    occluderCacheLookups.fetch_add(1, std::memory_order_relaxed);
+    if(cachedOccluder != nullptr && shapeOccludes(cachedOccluder, ray, minT, maxT, scene)){
+        occluderCacheHits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
 
-            // Find intersection if possible
-            Ray ray {point, lightPosition - point};
+    std::optional<Intersect> intersection = intersect(scene, ray);
+    if(!intersection.has_value() || intersection.value().t < minT || intersection.value().t > maxT)
+        return false;
 
-            std::optional<Intersect> intersection = intersect(scene, ray);
-            // If intersection, continue
-            if(intersection.has_value())
-                continue;
+    // Only whole scene shapes can be tested on their own: blends mix several shapes, and members of SDF groups
+    // can be carved away by the rest of their group (so the group is cached instead). Smooth merging can pull any
+    // surface out past its shape.
+    const PPShape& occluder = intersection.value().shape;
+    if(!occluder.isPlural && !rayMarchSettings.smoothMergeEnabled){
+        if(occluder.instance != nullptr)
+            cachedOccluder = occluder.instance;
+        else if(occluder.group != nullptr)
+            cachedOccluder = occluder.group;
+        else
+            cachedOccluder = occluder.shapes[0];
+    }
+    return true;
+}
+
+OccluderCacheStats occluderCacheStats(){
+    return OccluderCacheStats{occluderCacheLookups.load(), occluderCacheHits.load()};
+}
+
+void resetOccluderCacheStats(){
+    occluderCacheLookups = 0;
+    occluderCacheHits = 0;
+}
+
+uint64_t droppedSecondaryRayCount(){
+    return droppedSecondaryRays.load();
+}
+
+void resetDroppedSecondaryRayCount(){
+    droppedSecondaryRays = 0;
+}
 
-            // If no intersection, compute attenuation add add to illumination
-            float distance = glm::distance(point, lightPosition);
-            float attenuation = std::min(1.0f, 1.0f / (light.function.x + distance * light.function.y + distance * distance * light.function.z));
+// Whether something lies between the point and a sample point on an area light
+bool areaLightSampleOccluded(glm::vec4 point, glm::vec4 lightPosition, const SceneLightData& light, const RayTraceScene& scene){
+    // The ray reaches the light at t = 1, anything beyond it can't cast a shadow
+    return shadowRayBlocked(Ray{point, lightPosition - point}, 0.0f, 1.0f, light, scene);
+}
+
+glm::vec4 getAreaLightIllumination(glm::vec4 point, const SceneLightData& light, RayTracer& raytracer, const RayTraceScene& scene){
+    const AreaLightSamples& samples = scene.getAreaLightSamples(light);
+    const int numPoints = samples.points.size();
+    if(numPoints == 0)
+        return glm::vec4{};
+
+    // With probes on, a lattice of samples spread over the light is traced first. If they all agree, the point is taken
+    // to be fully lit (or fully in shadow), so only points in a penumbra trace the whole grid.
+    const int* probes = samples.probes.data();
+    const int numProbes = raytracer.m_config.enableAreaLightProbes ? (int)samples.probes.size() : 0;
+    bool probeOccluded[AREA_LIGHT_PROBE_STRATA * AREA_LIGHT_PROBE_STRATA];
+    int numProbesOccluded = 0;
+    for(int i = 0; i < numProbes; i++){
+        probeOccluded[i] = areaLightSampleOccluded(point, samples.points[probes[i]], light, scene);
+        numProbesOccluded += probeOccluded[i];
+    }
+    if(numProbes > 0 && numProbesOccluded == numProbes)
+        return glm::vec4{};
+    const bool traceGrid = numProbes == 0 || numProbesOccluded > 0;
 
-            illuminationFactor += attenuation;
+    float illuminationFactor = 0;
+    for(int i = 0; i < numPoints; i++){
+        const glm::vec4& lightPosition = samples.points[i];
+        if(traceGrid){
+            const int* probe = std::find(probes, probes + numProbes, i);
+            bool occluded = probe != probes + numProbes ? probeOccluded[probe - probes]
+                                                        : areaLightSampleOccluded(point, lightPosition, light, scene);
+            if(occluded)
+                continue;
         }
+
+        // If no intersection, compute attenuation add add to illumination
+        float distance = glm::distance(point, lightPosition);
+        float attenuation = std::min(1.0f, 1.0f / (light.function.x + distance * light.function.y + distance * distance * light.function.z));
+
+        illuminationFactor += attenuation;
     }
-    return light.color * illuminationFactor / numPoints;
+    return light.color * illuminationFactor / (float)numPoints;
 }
 
-glm::vec4 getIllumination(glm::vec4 point, const SceneLightData& light, RayTracer& raytracer, const RayTraceScene& scene){
+glm::vec4 getIllumination(glm::vec4 point, const LightContext& lightContext, RayTracer& raytracer, const RayTraceScene& scene){
+    const SceneLightData& light = *lightContext.light;
     float attenuation = getAttenuation(point, light);
     switch(light.type){
     case LightType::LIGHT_AREA:
+        // The soft shadow march stands in for the light's extent
+        if(usesSoftShadowMarch(light))
+            return attenuation * light.color;
         // Need to trace several beams to different points on the light
         return getAreaLightIllumination(point, light, raytracer, scene);
     case LightType::LIGHT_DIRECTIONAL:
     case LightType::LIGHT_POINT:
         return attenuation * light.color;
     case LightType::LIGHT_SPOT:
-        float attenuation = getAttenuation(point, light);
-        // Get angle for the point in the spotlight view
-        float inner = light.angle - light.penumbra;
-        float x = glm::acos(glm::dot(glm::normalize(light.dir), glm::normalize(point - light.pos)));
-        if(x <= inner)
-            return light.color;
-
-        float outer = light.angle;
-        if(x > outer)
+        // Compare cosines against the cone, so only points in the penumbra need the angle itself
+        float cosine = glm::dot(lightContext.direction, glm::normalize(point - light.pos));
+        if(cosine >= lightContext.cosInner)
+            return attenuation * light.color;
+        if(cosine < lightContext.cosOuter)
             return glm::vec4{0,0,0,0};
 
-        float f = fallout(x, inner, outer);
+        float inner = light.angle - light.penumbra;
+        float outer = light.angle;
+        float f = fallout(glm::acos(cosine), inner, outer);
         return attenuation * (1 - f) * light.color;
     }
     return glm::vec4{};
@@ -128,130 +220,455 @@ bool inShadow(glm::vec4 point, const SceneLightData& light, const RayTraceScene&
     glm::vec4 lightDirection = getLightDirection(point, light);
     Ray shadowRay {point, -lightDirection};
 
-    glm::vec3 direction3 = lightDirection;
-    float lightLength = glm::length(direction3);
+    // Point and spot light rays reach the light at t = 1
+    float maxT = light.type == LightType::LIGHT_DIRECTIONAL ? std::numeric_limits<float>::infinity() : 1.0f;
+    return shadowRayBlocked(shadowRay, 0.01f, maxT, light, scene);
+}
+
+// How much of the light reaches the point (on a surface with the given normal), from 0 (in shadow) to 1 (fully lit)
+float shadowVisibility(glm::vec4 point, glm::vec4 normal, const SceneLightData& light, const RayTraceScene& scene, RayTracer& raytracer){
+    if(!usesSoftShadowMarch(light)){
+        const ShadowMap& shadowMap = raytracer.getShadowMap(light, scene);
+        if(!shadowMap.empty())
+            return shadowMap.visibility(point, normal);
+        return inShadow(point, light, scene, raytracer) ? 0.0f : 1.0f;
+    }
+
+    glm::vec4 toLight = -getLightDirection(point, light);
+    float maxT = light.type == LightType::LIGHT_DIRECTIONAL ? MAX_SHADOW_DISTANCE : glm::length(toLight);
+    Ray shadowRay {point, glm::normalize(toLight)};
+    return softShadowMarch(scene, shadowRay, SHADOW_RAY_OFFSET, maxT, light.softness);
+}
+
+// Surfaces seen at a grazing angle cover more of the texture per pixel, up to this many times as much
+const static float MAX_TEXTURE_FORESHORTENING = 4.0f;
+
+// How far apart two texture coordinates are, going the short way around the seam where they wrap
+static float wrappedDistance(float a, float b){
+    float distance = std::abs(a - b);
+    return std::min(distance, 1.0f - distance);
+}
+
+// The texture coordinates of the point on the shape. Members of an instance's prototype are placed in the
+// prototype's space, so the point is taken there first.
+static TextureMap textureMapAt(const Shape* shape, const Shape* instance, glm::vec4 position){
+    if(instance != nullptr)
+        position = instance->m_ctm_inverse * position;
+    return shape->getTextureMap(position);
+}
 
-    std::optional<Intersect> shadowResult = intersect(scene, shadowRay);
-    glm::vec3 shadowIntersection = shadowRay.evaluate(shadowResult->t);
-    glm::vec3 point3 = point;
-    float shadowTLength = glm::length(shadowIntersection - point3) / lightLength;
-    return shadowResult.has_value() && shadowResult.value().t >= 0.01f  && (light.type == LightType::LIGHT_DIRECTIONAL || shadowTLength <= 1.0f);
+/**
+ * The log2 of how many full resolution texels of the texture one pixel covers at the point, from how far the
+ * shape's texture coordinates move over a pixel's width along the surface.
+ */
+static float textureLod(const Shape* shape, const Shape* instance, glm::vec4 position, glm::vec4 normal, glm::vec4 directionToCamera,
+                        float footprint, TextureMap map, const SceneFileMap& fileMap, const Texture& texture){
+    float facing = std::abs(glm::dot(normal, directionToCamera));
+    footprint /= std::max(facing, 1.0f / MAX_TEXTURE_FORESHORTENING);
+
+    glm::vec3 n = normal;
+    glm::vec4 tangent = glm::vec4(glm::normalize(glm::cross(n, std::abs(n.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0))), 0);
+    glm::vec4 bitangent = glm::vec4(glm::cross(n, glm::vec3(tangent)), 0);
+    TextureMap alongTangent = textureMapAt(shape, instance, position + footprint * tangent);
+    TextureMap alongBitangent = textureMapAt(shape, instance, position + footprint * bitangent);
+
+    float du = std::max(wrappedDistance(alongTangent.u, map.u), wrappedDistance(alongBitangent.u, map.u));
+    float dv = std::max(wrappedDistance(alongTangent.v, map.v), wrappedDistance(alongBitangent.v, map.v));
+    float texels = std::max(du * fileMap.repeatU * texture.width(), dv * fileMap.repeatV * texture.height());
+    return std::log2(std::max(texels, 1e-6f));
 }
 
-glm::vec4 getTextureColor(const Shape* shape, glm::vec4 position, const SceneMaterial& material, RayTracer& raytracer, float kd){
+// footprint is the world space width of the pixel at the point, which picks the mip level when filtering. instance
+// is the instance the shape was hit through, if any.
+glm::vec4 getTextureColor(const Shape* shape, const Shape* instance, glm::vec4 position, glm::vec4 normal, glm::vec4 directionToCamera,
+                          float footprint, const SceneMaterial& material, RayTracer& raytracer, float kd){
     if(!raytracer.m_config.enableTextureMap || material.blend == 0)
         return material.cDiffuse * kd;
 
-    TextureMap map = shape->getTextureMap(position);
-    Texture& texture = raytracer.getTexture(material.textureMap);
-    int w = texture.width;
-    int h = texture.height;
-
-    int c = (int)std::floor(map.u * material.textureMap.repeatU * w) % w;
-    int r = (int)std::floor(std::max(1 - map.v, 0.0f) * material.textureMap.repeatV * h) % h;
-
-    const int idx = w * r + c;
-    RGBA& textureValue = texture.data[idx];
-    glm::vec4 textureColor{
-        (float)textureValue.r / 255,
-        (float)textureValue.g / 255,
-        (float)textureValue.b / 255,
-        1,
-    };
+    const Texture* texture = raytracer.getTexture(material.textureMap);
+    if(texture == nullptr)
+        return material.cDiffuse * kd;
+
+    TextureMap map = textureMapAt(shape, instance, position);
+    float s = map.u * material.textureMap.repeatU;
+    float t = std::max(1 - map.v, 0.0f) * material.textureMap.repeatV;
+
+    glm::vec4 textureColor;
+    if(raytracer.m_config.enableTextureFilter){
+        float lod = textureLod(shape, instance, position, normal, directionToCamera, footprint, map, material.textureMap, *texture);
+        textureColor = texture->sampleTrilinear(s, t, lod);
+    } else {
+        textureColor = texture->sampleNearest(s, t);
+    }
 
     return material.blend * textureColor + (1 - material.blend) * material.cDiffuse * kd;
 }
 
 const static int RECURSIVE_DEPTH_LIMIT = 5;
+// Lights picked from the light tree at each shaded point
+const static int LIGHT_TREE_SAMPLES = 8;
+
+// A number in [0, 1) that depends only on the point and the sample index, so renders are repeatable no matter
+// which thread shades which pixel
+static float hashToUnitFloat(glm::vec4 point, int sample){
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < 3; i++){
+        uint32_t bits;
+        std::memcpy(&bits, &point[i], sizeof(bits));
+        hash = (hash ^ bits) * 16777619u;
+    }
+    hash = (hash ^ (uint32_t)sample) * 16777619u;
+    // Finish with a PCG style permutation, since FNV leaves the low bits poorly mixed
+    hash = hash * 747796405u + 2891336453u;
+    hash = ((hash >> ((hash >> 28u) + 4u)) ^ hash) * 277803737u;
+    hash = (hash >> 22u) ^ hash;
+    return (hash >> 8) * (1.0f / 16777216.0f);
+}
 
-// Calculates the RGBA of a pixel from intersection infomation and globally-defined coefficients
-SceneColor computePixelLighting(glm::vec4  position,
-           glm::vec4  normal,
-           glm::vec4  directionToCamera,
-           PPShape shape,
-           int recursiveDepth,
-           const RayTraceScene& scene,
-           RayTracer& raytracer) {
+static float maxChannel(glm::vec4 color){
+    return std::max(color.r, std::max(color.g, color.b));
+}
 
-    if (shape.isPlural) {
-        std::vector<SceneColor> colors;
-        for (const Shape* s : shape.shapes) {
-            std::vector<float> blends{1.0f};
-            std::vector<const Shape*> shapeVec;
-            shapeVec.emplace_back(s);
-
-            SceneColor currColor = computePixelLighting(position,
-                                                        normal,
-                                                        directionToCamera,
-                                                        {false, blends, shapeVec},
-                                                        recursiveDepth,
-                                                        scene,
-                                                        raytracer);
-
-            colors.push_back(currColor);
-        }
+// Light arriving at a shaded point from one light, after attenuation and shadowing, and the direction toward it
+struct IncidentLight {
+    glm::vec4 luminance;
+    glm::vec4 direction;
+};
+
+// The light that arrives at a point from one light (zero if it doesn't reach the point)
+static glm::vec4 incidentLuminance(glm::vec4 position,
+                                   glm::vec4 normal,
+                                   const LightContext& lightContext,
+                                   const RayTraceScene& scene,
+                                   RayTracer& raytracer) {
+    const SceneLightData& light = *lightContext.light;
+    // Skip lights that are too far away to matter, or that don't reach the point (outside a spot light's cone),
+    // before tracing any shadow rays
+    if(light.type != LightType::LIGHT_DIRECTIONAL
+        && glm::distance(glm::vec3(position), glm::vec3(light.pos)) > lightContext.influenceRadius)
+        return glm::vec4{};
+
+    // Gets the luminance of light at that point (including attenuation)
+    glm::vec4 luminance = getIllumination(position, lightContext, raytracer, scene);
+    // If our luminance is very low, just move on to the next light
+    // Can give shadowing effect for area lights
+    if(isClose(glm::length(luminance), 0))
+        return glm::vec4{};
+
+    // Check if there is a shadow with the light source (aka if we trace a ray, it can reach the light source)
+    float visibility = raytracer.m_config.enableShadow ? shadowVisibility(position, normal, light, scene, raytracer) : 1.0f;
+    if(visibility <= 0)
+        return glm::vec4{};
+    return luminance * visibility;
+}
 
-        SceneColor finalSceneColor = glm::vec4(0.0f);
-        for (int i = 0; i < colors.size(); i++) {
-            finalSceneColor += shape.blends[i] * colors[i];
-        }
+/**
+ * Gathers the light arriving at a point, which only depends on the point and its normal and not on the material,
+ * so blended shapes can share it. Lights that don't reach the point are left out.
+ */
+static void gatherIncidentLight(glm::vec4 position,
+                                glm::vec4 normal,
+                                const RenderContext& context,
+                                const RayTraceScene& scene,
+                                RayTracer& raytracer,
+                                std::vector<IncidentLight>& incident) {
+    incident.clear();
+    const std::vector<LightContext>& lights = context.lights;
+    auto add = [&](const LightContext& light, float weight) {
+        glm::vec4 luminance = incidentLuminance(position, normal, light, scene, raytracer);
+        if(luminance == glm::vec4(0))
+            return;
+        glm::vec4 direction = light.light->type == LightType::LIGHT_DIRECTIONAL
+                              ? -light.direction : glm::normalize(light.light->pos - position);
+        incident.push_back(IncidentLight{luminance * weight, direction});
+    };
 
-        return finalSceneColor;
+    if (!raytracer.m_config.enableLightTree) {
+        for (const LightContext& light : lights) {
+            add(light, 1.0f);
+        }
+        return;
     }
 
-    // Normalizing directions
-    normal            = glm::normalize(normal);
-    directionToCamera = glm::normalize(directionToCamera);
+    for (int lightIndex : scene.getExplicitLights()) {
+        add(lights[lightIndex], 1.0f);
+    }
 
-    // std::cout << normal[0] << ", " << normal[1] << ", " << normal[2] << std::endl;
-    // std::cout << directionToCamera[0] << ", " << directionToCamera[1] << ", " << directionToCamera[2] << std::endl;
+    // Many-light scenes only evaluate a few of their point and spot lights at each point, picked in proportion to
+    // how much they could contribute and weighted by how likely they were to be picked
+    const LightTree& lightTree = scene.getLightTree();
+    if (!lightTree.empty()) {
+        for (int i = 0; i < LIGHT_TREE_SAMPLES; i++) {
+            float pdf;
+            int lightIndex = lightTree.sample(position, hashToUnitFloat(position, i), pdf);
+            if (pdf > 0)
+                add(lights[lightIndex], 1.0f / (LIGHT_TREE_SAMPLES * pdf));
+        }
+    }
+}
 
+/**
+ * The ambient, diffuse and specular light leaving a point on a single shape, lit by the gathered incident light,
+ * without reflections or refractions. footprint is the world space width of the pixel at the point.
+ *
+ * Specialized on the material's features, so materials without a specular term or a texture don't pay for them
+ * at every point and light.
+ */
+template <bool specular, bool textured>
+static glm::vec4 shadeSurfaceWith(glm::vec4 position,
+                                  glm::vec4 normal,
+                                  glm::vec4 directionToCamera,
+                                  const Shape* shape,
+                                  const Shape* instance,
+                                  float footprint,
+                                  const std::vector<IncidentLight>& incident,
+                                  const RenderContext& context,
+                                  RayTracer& raytracer) {
     // Output illumination (we can ignore opacity)
     glm::vec4 illumination(0, 0, 0, 1);
-    const std::vector<SceneLightData>& lights = scene.getLights();
-    const SceneGlobalData& globalData = scene.getGlobalData();
-    const SceneMaterial& material = shape.shapes[0]->m_primative.material;
+    const SceneGlobalData& globalData = context.globalData;
+    const SceneMaterial& material = *shape->m_material;
     illumination += globalData.ka * material.cAmbient;
-    // std::cout << illumination[0] << ", " << illumination[1] << ", " << illumination[2] << std::endl;
-    glm::vec4 diffuseColor = getTextureColor(shape.shapes[0], position, material, raytracer, globalData.kd);
+    glm::vec4 diffuseColor = material.cDiffuse * globalData.kd;
+    if constexpr (textured)
+        diffuseColor = getTextureColor(shape, instance, position, normal, directionToCamera, footprint, material, raytracer, globalData.kd);
+
+    for (const IncidentLight& light : incident) {
+        glm::vec4 di = light.direction;
+        illumination += light.luminance * diffuseColor * std::max(0.0f, glm::dot(normal, di));
+
+        if constexpr (specular) {
+            glm::vec4 ri = (2 * glm::dot(normal, di) * normal) - di;
+            illumination += light.luminance * globalData.ks * material.cSpecular
+                    * (float)std::pow(std::max(0.0f, glm::dot(glm::normalize(ri), directionToCamera)), material.shininess);
+        }
+    }
 
-    for (const SceneLightData& light : lights) {
-        // Check if there is a shadow with the light source (aka if we trace a ray, it can reach the light source)
-        if(raytracer.m_config.enableShadow && inShadow(position, light, scene, raytracer))
-            continue;
+    return illumination;
+}
+
+static glm::vec4 shadeSurface(glm::vec4 position,
+                              glm::vec4 normal,
+                              glm::vec4 directionToCamera,
+                              const Shape* shape,
+                              const Shape* instance,
+                              float footprint,
+                              const std::vector<IncidentLight>& incident,
+                              const RenderContext& context,
+                              RayTracer& raytracer) {
+    switch (shape->m_material->features & (MATERIAL_SPECULAR | MATERIAL_TEXTURED)) {
+    case 0:
+        return shadeSurfaceWith<false, false>(position, normal, directionToCamera, shape, instance, footprint, incident, context, raytracer);
+    case MATERIAL_SPECULAR:
+        return shadeSurfaceWith<true, false>(position, normal, directionToCamera, shape, instance, footprint, incident, context, raytracer);
+    case MATERIAL_TEXTURED:
+        return shadeSurfaceWith<false, true>(position, normal, directionToCamera, shape, instance, footprint, incident, context, raytracer);
+    default:
+        return shadeSurfaceWith<true, true>(position, normal, directionToCamera, shape, instance, footprint, incident, context, raytracer);
+    }
+}
 
-        glm::vec4 direction = getLightDirection(position, light);
-        glm::vec4 di = -glm::normalize(direction);
-        glm::vec4 ri = (2 * glm::dot(normal, di) * normal) - di;
+// Secondary rays start (or are only counted as hitting something) this far from the surface they leave
+const static float SECONDARY_RAY_OFFSET = 0.01;
+// Each hit queues at most a reflected and a refracted ray per shape, and the newest ray is always traced first,
+// so the stack only has to hold a few rays per bounce
+const static int MAX_PENDING_RAYS = 64;
+
+// A secondary ray waiting to be traced, and how much of the color it finds reaches the pixel
+struct PendingRay {
+    Ray ray;
+    glm::vec4 weight;
+    int depth;
+    float distance; // How far the ray has come from the eye, along the path of rays before it
+};
+
+/**
+ * The secondary rays of one pixel that are still to be traced. Lives on the shading thread's stack with a fixed
+ * capacity, so following reflections and refractions never allocates.
+ */
+class RayStack {
+public:
+    bool empty() const { return m_size == 0; }
+
+    // Drops the ray if the stack is full, which only very deep trees of plural shapes can reach. Dropped rays are
+    // counted, for the render's stats.
+    void push(const PendingRay& ray) {
+        if (m_size < MAX_PENDING_RAYS)
+            m_rays[m_size++] = ray;
+        else
+            droppedSecondaryRays.fetch_add(1, std::memory_order_relaxed);
+    }
 
-        // Gets the luminance of light at that point (including attenuation)
-        glm::vec4 luminance = getIllumination(position, light, raytracer, scene);
-        // If our luminance is very low, just move on to the next light
-        // Can give shadowing effect for area lights
-        if(isClose(glm::length(luminance), 0))
-            continue;
+    PendingRay pop() { return m_rays[--m_size]; }
+
+private:
+    std::array<PendingRay, MAX_PENDING_RAYS> m_rays;
+    int m_size = 0;
+};
+
+/**
+ * Whether a secondary ray is still worth tracing, given the weight it would add to the pixel with. Rays that would
+ * add less than the threshold are dropped, unless Russian roulette keeps them at random: a faint ray survives with
+ * probability weight / threshold, and when it does, counts for that much more (weight is scaled up to match).
+ */
+static bool keepSecondaryRay(glm::vec4& weight, glm::vec4 position, int sample, const RayTracer& raytracer){
+    float pathWeight = maxChannel(weight);
+    if(pathWeight <= 0)
+        return false;
 
-        illumination += luminance * diffuseColor * std::max(0.0f, glm::dot(normal, di));
-        // std::cout << illumination[0] << ", " << illumination[1] << ", " << illumination[2] << std::endl;
+    const float threshold = raytracer.m_config.reflectionThreshold;
+    if(pathWeight >= threshold)
+        return true;
+    float survival = pathWeight / threshold;
+    if(!raytracer.m_config.enableRussianRoulette || hashToUnitFloat(position, sample) >= survival)
+        return false;
+    weight /= survival;
+    return true;
+}
 
-        illumination += luminance * globalData.ks * material.cSpecular
-                * (float)std::pow(std::max(0.0f, glm::dot(glm::normalize(ri), directionToCamera)), material.shininess);
-        // std::cout << illumination[0] << ", " << illumination[1] << ", " << illumination[2] << std::endl;
+/**
+ * Queues the ray refracted into (or out of) the shape at a hit. Only hits found analytically refract: marched shapes
+ * (including the members of marched groups and instances) have no inside to march through, so they stay opaque.
+ * weight is how much of the shape's color reaches the pixel, and the queued ray's weight includes it. Returns the
+ * weight of any light that is reflected instead.
+ */
+static glm::vec4 queueRefractedRay(glm::vec4 position,
+                                   glm::vec4 normal,
+                                   glm::vec4 directionToCamera,
+                                   const Shape* shape,
+                                   bool marched,
+                                   glm::vec4 weight,
+                                   int depth,
+                                   float distance,
+                                   RayStack& pending,
+                                   const RenderContext& context,
+                                   const RayTraceScene& scene,
+                                   const RayTracer& raytracer){
+    const SceneMaterial& material = *shape->m_material;
+    glm::vec4 refractionWeight = material.cTransparent * context.globalData.kt;
+    if(!raytracer.m_config.enableRefraction || maxChannel(refractionWeight) <= 0 || marched)
+        return glm::vec4(0);
+
+    // Refraction by Snell's law, bending toward the normal on the way into the shape and away from it on the way
+    // out. Light that can't get out (total internal reflection) is reflected instead.
+    glm::vec4 incoming = -directionToCamera;
+    glm::vec4 facingNormal = normal;
+    float ior = material.ior > 0 ? material.ior : 1.0f;
+    float eta = 1.0f / ior;
+    float cosine = -glm::dot(incoming, normal);
+    if(cosine < 0){
+        eta = ior;
+        cosine = -cosine;
+        facingNormal = -normal;
     }
 
-    // Reflections
-    if(raytracer.m_config.enableReflection && recursiveDepth < RECURSIVE_DEPTH_LIMIT && !isClose(glm::length(material.cReflective), 0)){
+    float k = 1.0f - eta * eta * (1.0f - cosine * cosine);
+    if(k < 0)
+        return weight * refractionWeight;
+
+    glm::vec4 refractedDirection = eta * incoming + (eta * cosine - std::sqrt(k)) * facingNormal;
+    glm::vec4 rayWeight = weight * refractionWeight;
+    if(keepSecondaryRay(rayWeight, position, -1 - depth - RECURSIVE_DEPTH_LIMIT, raytracer))
+        pending.push(PendingRay{Ray{position + SECONDARY_RAY_OFFSET * refractedDirection, refractedDirection}, rayWeight, depth + 1, distance});
+    return glm::vec4(0);
+}
+
+/**
+ * Queues the rays reflected and refracted at a hit. weight is how much of the hit's color reaches the pixel, and
+ * the queued rays' weights include it. Blended shapes share one reflected ray, weighted by each shape's blend and
+ * reflectivity, since they all reflect in the same direction.
+ */
+static void queueSecondaryRays(glm::vec4 position,
+                               glm::vec4 normal,
+                               glm::vec4 directionToCamera,
+                               const PPShape& shape,
+                               glm::vec4 weight,
+                               int depth,
+                               float distance,
+                               RayStack& pending,
+                               const RenderContext& context,
+                               const RayTraceScene& scene,
+                               const RayTracer& raytracer){
+    if(depth >= RECURSIVE_DEPTH_LIMIT)
+        return;
+
+    glm::vec4 rayWeight(0.0f);
+    for(int i = 0; i < shape.shapes.size(); i++){
+        glm::vec4 shapeWeight = shape.isPlural ? weight * shape.blends[i] : weight;
+        const SceneMaterial& material = *shape.shapes[i]->m_material;
+        if(raytracer.m_config.enableReflection && (material.features & MATERIAL_REFLECTIVE))
+            rayWeight += shapeWeight * material.cReflective * context.globalData.ks;
+        if(material.features & MATERIAL_TRANSPARENT)
+            rayWeight += queueRefractedRay(position, normal, directionToCamera, shape.shapes[i], shape.marched,
+                                           shapeWeight, depth, distance, pending, context, scene, raytracer);
+    }
+
+    if(keepSecondaryRay(rayWeight, position, -1 - depth, raytracer)){
         glm::vec4 reflectedDirection = 2 * glm::dot(normal, directionToCamera) * normal - directionToCamera;
+        pending.push(PendingRay{Ray{position, reflectedDirection}, rayWeight, depth + 1, distance});
+    }
+}
 
-        Ray reflectedRay{position, reflectedDirection};
-        std::optional<Intersect> reflectionIntersect = intersect(scene, reflectedRay);
-        if(reflectionIntersect.has_value() && reflectionIntersect.value().t >= 0.01){
-            std::cout << "REFLECTED" << std::endl;
-            Intersect& inter = reflectionIntersect.value();
-            glm::vec4 position = reflectedRay.evaluate(inter.t);
-            SceneColor reflectedColor = computePixelLighting(position, glm::vec4{inter.normal, 0}, -reflectedDirection, inter.shape, recursiveDepth + 1, scene, raytracer);
-            illumination += material.cReflective * reflectedColor * globalData.ks;
-        }
+/**
+ * Shades a hit without its reflections and refractions, which are queued instead. Returns the hit's color scaled
+ * by weight. distance is how far the hit is from the eye, along the path of rays that reached it.
+ */
+static glm::vec4 shadeHit(glm::vec4 position,
+                          glm::vec4 normal,
+                          glm::vec4 directionToCamera,
+                          const PPShape& shape,
+                          glm::vec4 weight,
+                          int depth,
+                          float distance,
+                          RayStack& pending,
+                          const RenderContext& context,
+                          const RayTraceScene& scene,
+                          RayTracer& raytracer){
+    // Normalizing directions
+    normal            = glm::normalize(normal);
+    directionToCamera = glm::normalize(directionToCamera);
+
+    queueSecondaryRays(position, normal, directionToCamera, shape, weight, depth, distance, pending, context, scene, raytracer);
+    const float footprint = scene.pixelWidth(distance);
+
+    // Shadow rays and light sampling only depend on the point, so blended shapes gather them once and only
+    // differ in their materials
+    thread_local std::vector<IncidentLight> incident;
+    gatherIncidentLight(position, normal, context, scene, raytracer, incident);
+
+    if(!shape.isPlural)
+        return weight * shadeSurface(position, normal, directionToCamera, shape.shapes[0], shape.instance, footprint, incident, context, raytracer);
+
+    glm::vec4 color(0.0f);
+    for(int i = 0; i < shape.shapes.size(); i++){
+        color += weight * shape.blends[i] * shadeSurface(position, normal, directionToCamera, shape.shapes[i], nullptr, footprint, incident, context, raytracer);
+    }
+    return color;
+}
+
+// Calculates the RGBA of a pixel from intersection infomation and globally-defined coefficients. The reflected and
+// refracted rays below the hit are followed with an explicit stack instead of recursion.
+SceneColor computePixelLighting(glm::vec4  position,
+           glm::vec4  normal,
+           glm::vec4  directionToCamera,
+           PPShape shape,
+           int recursiveDepth,
+           const RenderContext& context,
+           const RayTraceScene& scene,
+           RayTracer& raytracer) {
+    RayStack pending;
+    glm::vec4 illumination = shadeHit(position, normal, directionToCamera, shape, glm::vec4(1.0f), recursiveDepth,
+                                      glm::length(directionToCamera), pending, context, scene, raytracer);
+
+    while(!pending.empty()){
+        PendingRay next = pending.pop();
+        std::optional<Intersect> intersection = intersect(scene, next.ray);
+        if(!intersection.has_value() || intersection.value().t < SECONDARY_RAY_OFFSET)
+            continue;
+
+        Intersect& inter = intersection.value();
+        illumination += shadeHit(next.ray.evaluate(inter.t), glm::vec4{inter.normal, 0}, -next.ray.d, inter.shape,
+                                 next.weight, next.depth, next.distance + inter.t, pending, context, scene, raytracer);
     }
 
     return illumination;
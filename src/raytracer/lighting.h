@@ -2,6 +2,7 @@
 
 #include "glm/fwd.hpp"
 #include "raytracer/raytracescene.h"
+#include "raytracer/rendercontext.h"
 #include "utils/scenedata.h"
 #include <vector>
 
@@ -10,7 +11,26 @@ SceneColor computePixelLighting(glm::vec4  position,
            glm::vec4  directionToCamera,
            PPShape shape,
            int recursiveDepth,
+           const RenderContext& context,
            const RayTraceScene& scene,
            RayTracer& rayTracer);
 
 RGBA toRGBA(const glm::vec4 &illumination);
+
+// Whether the light's shadows come from a single penumbra-estimating march instead of hard shadow rays
+// (or, for area lights, a grid of them)
+bool usesSoftShadowMarch(const SceneLightData& light);
+
+// How often a shadow ray was blocked by the shape that last blocked a ray toward the same light (on that thread),
+// sparing a full scene query
+struct OccluderCacheStats {
+    uint64_t lookups;
+    uint64_t hits;
+};
+
+OccluderCacheStats occluderCacheStats();
+void resetOccluderCacheStats();
+
+// How many reflected and refracted rays were dropped because a pixel already had too many waiting to be traced
+uint64_t droppedSecondaryRayCount();
+void resetDroppedSecondaryRayCount();
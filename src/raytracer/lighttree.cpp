@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <limits>
+#include "lighttree.h"
+
+static float lightIntensity(const SceneLightData& light) {
+    return std::max(light.color.r, std::max(light.color.g, light.color.b));
+}
+
+void LightTree::build(const std::vector<SceneLightData>& lights, const std::vector<int>& lightIndices) {
+    m_nodes.clear();
+    if (lightIndices.empty())
+        return;
+
+    std::vector<int> indices = lightIndices;
+    m_nodes.reserve(2 * indices.size() - 1);
+    buildNode(lights, indices, 0, indices.size());
+}
+
+bool LightTree::empty() const {
+    return m_nodes.empty();
+}
+
+/**
+ * Builds the subtree over lightIndices[begin, end) and returns its root, splitting at the median along the
+ * longest axis of the lights' positions.
+ */
+int LightTree::buildNode(const std::vector<SceneLightData>& lights, std::vector<int>& lightIndices, int begin, int end) {
+    int nodeIndex = m_nodes.size();
+    m_nodes.emplace_back();
+
+    Node node;
+    node.boundsMin = glm::vec3(std::numeric_limits<float>::infinity());
+    node.boundsMax = glm::vec3(-std::numeric_limits<float>::infinity());
+    node.intensity = 0;
+    for (int i = begin; i < end; i++) {
+        const SceneLightData& light = lights[lightIndices[i]];
+        node.boundsMin = glm::min(node.boundsMin, glm::vec3(light.pos));
+        node.boundsMax = glm::max(node.boundsMax, glm::vec3(light.pos));
+        node.intensity += lightIntensity(light);
+    }
+
+    if (end - begin == 1) {
+        node.light = lightIndices[begin];
+        m_nodes[nodeIndex] = node;
+        return nodeIndex;
+    }
+
+    glm::vec3 extent = node.boundsMax - node.boundsMin;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int middle = (begin + end) / 2;
+    std::nth_element(lightIndices.begin() + begin, lightIndices.begin() + middle, lightIndices.begin() + end,
+                     [&](int a, int b) { return lights[a].pos[axis] < lights[b].pos[axis]; });
+
+    node.left = buildNode(lights, lightIndices, begin, middle);
+    node.right = buildNode(lights, lightIndices, middle, end);
+    m_nodes[nodeIndex] = node;
+    return nodeIndex;
+}
+
+// How much the node's lights could contribute at the point: their intensity over the squared distance to the
+// node, which is never taken to be less than the node's size so nearby clusters aren't overweighted
+float LightTree::importance(const Node& node, glm::vec3 point) const {
+    glm::vec3 center = (node.boundsMin + node.boundsMax) / 2.0f;
+    glm::vec3 halfExtent = (node.boundsMax - node.boundsMin) / 2.0f;
+    float distanceSquared = glm::dot(point - center, point - center);
+    float sizeSquared = std::max(glm::dot(halfExtent, halfExtent), 1e-4f);
+    return node.intensity / std::max(distanceSquared, sizeSquared);
+}
+
+int LightTree::sample(glm::vec3 point, float u, float& pdf) const {
+    pdf = 1.0f;
+    int nodeIndex = 0;
+    while (m_nodes[nodeIndex].light < 0) {
+        const Node& node = m_nodes[nodeIndex];
+        float leftImportance = importance(m_nodes[node.left], point);
+        float rightImportance = importance(m_nodes[node.right], point);
+        float total = leftImportance + rightImportance;
+        float leftProbability = total > 0 ? leftImportance / total : 0.5f;
+
+        // Reuse u for the next level by rescaling the part of [0, 1) that picked this child
+        if (u < leftProbability) {
+            u /= leftProbability;
+            pdf *= leftProbability;
+            nodeIndex = node.left;
+        } else {
+            u = (u - leftProbability) / (1.0f - leftProbability);
+            pdf *= 1.0f - leftProbability;
+            nodeIndex = node.right;
+        }
+        u = std::min(u, 0.99999994f);
+    }
+    return m_nodes[nodeIndex].light;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/scenedata.h"
+
+/**
+ * A bounding volume hierarchy over a scene's point and spot lights, for picking lights at random in proportion to
+ * how much they can contribute at a point. Each node stores the bounds and total intensity of the lights below it,
+ * so a pick walks one path from the root and costs O(log n) in the number of lights.
+ */
+class LightTree {
+public:
+    // Builds the tree over lights[i] for every i in lightIndices
+    void build(const std::vector<SceneLightData>& lights, const std::vector<int>& lightIndices);
+
+    bool empty() const;
+
+    /**
+     * @brief sample Picks a light for the point, using u (in [0, 1)) as the random number.
+     * @param pdf Set to the probability that the returned light was picked
+     * @return The index of the light in the lights the tree was built from
+     */
+    int sample(glm::vec3 point, float u, float& pdf) const;
+
+private:
+    struct Node {
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        float intensity;
+        int left = -1;  // Children, or -1 for leaves
+        int right = -1;
+        int light = -1; // Leaves only
+    };
+
+    std::vector<Node> m_nodes;
+
+    int buildNode(const std::vector<SceneLightData>& lights, std::vector<int>& lightIndices, int begin, int end);
+    float importance(const Node& node, glm::vec3 point) const;
+};
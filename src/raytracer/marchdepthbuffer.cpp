@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "marchdepthbuffer.h"
+#include "raytracer.h"
+#include "raytracescene.h"
+
+// How far (as a fraction of the depth) a hint is pulled back toward the eye, since the pixel's ray doesn't pass
+// exactly through the splatted hit points around it
+const static float START_MARGIN = 0.1f;
+// A pixel needs at least this many splatted hits in its 3x3 neighbourhood to get a hint. Single holes come from
+// resampling, larger ones from disocclusion.
+const static int MIN_NEIGHBOUR_HITS = 5;
+
+void MarchDepthBuffer::reset(int width, int height) {
+    m_width = width;
+    m_height = height;
+    m_hits.assign(width * height, glm::vec4(0));
+    m_depths.assign(width * height, std::numeric_limits<float>::infinity());
+    m_starts.assign(width * height, 0.0f);
+}
+
+void MarchDepthBuffer::reproject(const RayTraceScene& scene) {
+    if (m_width != scene.width() || m_height != scene.height()) {
+        reset(scene.width(), scene.height());
+        return;
+    }
+
+    const Camera& camera = scene.getCamera();
+    const glm::mat4 viewMatrix = camera.getViewMatrix();
+    const glm::vec4 eye = camera.getPosition();
+    const float viewplaneHeight = 2 * std::tan(camera.getHeightAngle() / 2);
+    const float viewplaneWidth = viewplaneHeight * camera.getAspectRatio();
+
+    // Splat every hit into the pixel the new camera sees it through (the inverse of makeRay)
+    std::fill(m_depths.begin(), m_depths.end(), std::numeric_limits<float>::infinity());
+    for (const glm::vec4& hit : m_hits) {
+        if (hit.w == 0)
+            continue;
+        glm::vec4 cameraHit = viewMatrix * hit;
+        if (cameraHit.z >= 0)
+            continue;
+        float x = cameraHit.x / -cameraHit.z;
+        float y = cameraHit.y / -cameraHit.z;
+        int i = std::lround((x / viewplaneWidth + 0.5f) * m_width - 0.5f);
+        int j = std::lround(m_height - 0.5f - (y / viewplaneHeight + 0.5f) * m_height);
+        if (i < 0 || i >= m_width || j < 0 || j >= m_height)
+            continue;
+        float& depth = m_depths[index(i, j)];
+        depth = std::min(depth, glm::distance(eye, hit));
+    }
+
+    #pragma omp parallel for
+    for (int j = 0; j < m_height; j++) {
+        for (int i = 0; i < m_width; i++) {
+            int neighbourHits = 0;
+            float closest = std::numeric_limits<float>::infinity();
+            for (int dj = -1; dj <= 1; dj++) {
+                for (int di = -1; di <= 1; di++) {
+                    int ni = i + di;
+                    int nj = j + dj;
+                    if (ni < 0 || ni >= m_width || nj < 0 || nj >= m_height)
+                        continue;
+                    float depth = m_depths[index(ni, nj)];
+                    if (std::isinf(depth))
+                        continue;
+                    neighbourHits++;
+                    closest = std::min(closest, depth);
+                }
+            }
+            m_starts[index(i, j)] = neighbourHits >= MIN_NEIGHBOUR_HITS ? closest * (1.0f - START_MARGIN) : 0.0f;
+        }
+    }
+}
+
+float MarchDepthBuffer::startDistance(int i, int j) const {
+    if (m_starts.empty())
+        return 0.0f;
+    return m_starts[index(i, j)];
+}
+
+void MarchDepthBuffer::record(int i, int j, const Ray& ray, float t) {
+    if (m_hits.empty())
+        return;
+    m_hits[index(i, j)] = std::isinf(t) ? glm::vec4(0) : ray.evaluate(t);
+}
+
+int MarchDepthBuffer::index(int i, int j) const {
+    return j * m_width + i;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+struct Ray;
+class RayTraceScene;
+
+/**
+ * Carries each pixel's primary hit over to the next frame of an animation, so the march through that pixel can
+ * start close to the surface instead of at the eye.
+ *
+ * The previous frame's hit points are splatted into the new camera, and each pixel's start distance is the
+ * closest splatted depth around it, pulled back by a margin. Pixels without enough splatted neighbours (ones that
+ * just became visible, or that missed everything) get no hint and march from the eye. The hint assumes the marched
+ * shapes stood still between the frames.
+ */
+class MarchDepthBuffer {
+public:
+    // Forgets the previous frame, so no pixel gets a hint until the next one is recorded
+    void reset(int width, int height);
+
+    // Turns the hits recorded for the previous frame into start distances for the scene's current camera
+    void reproject(const RayTraceScene& scene);
+
+    // The distance along the primary ray through pixel (i, j) that its march can start from (0 without a hint)
+    float startDistance(int i, int j) const;
+
+    // Records the primary ray through pixel (i, j) hitting at t (infinity for a miss), for the next frame
+    void record(int i, int j, const Ray& ray, float t);
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<glm::vec4> m_hits;   // World space hit points of the last frame (w = 0 for misses)
+    std::vector<float> m_depths;     // Closest splatted depth per pixel (infinity for none)
+    std::vector<float> m_starts;
+
+    int index(int i, int j) const;
+};
@@ -1,13 +1,14 @@
 #include "raytracer.h"
-#include "qimage.h"
 #include "utils/raymarchsettings.h"
 #include "raytracer/lighting.h"
 #include "raytracescene.h"
 #include "lighting.h"
+#include "shapes/instance.h"
 #include <iostream>
 #include <chrono>
 #include <cstdint>
 #include <mutex>
+#include <set>
 
 std::mutex progressBarMutex;
 
@@ -16,8 +17,12 @@ uint64_t timeSinceEpochMillisec() {
 }
 
 RayTracer::RayTracer(Config config) :
-    m_config(config)
-{}
+    m_config(config),
+    m_textures((std::size_t)std::max(0, config.textureBudgetMB) << 20, config.textureCacheDir)
+{
+    resetOccluderCacheStats();
+    resetDroppedSecondaryRayCount();
+}
 
 /**
  * Clamps the provided float value to the range [0,255]
@@ -56,22 +61,22 @@ Ray makeRay(const Camera& camera, const RayTraceScene& scene, const int i, const
 
 static const RGBA DEFAULT_COLOR = RGBA{0,0,0};
 
-RGBA RayTracer::raytrace(Ray ray, RayTraceScene& scene){
+RGBA RayTracer::raytrace(Ray ray, RayTraceScene& scene, float marchStart, float* hitDistance){
 
     const Camera& camera = scene.getCamera();
-    const SceneGlobalData& globalData = scene.getGlobalData();
-    const std::vector<SceneLightData> lights = scene.getLights();
 
     std::optional<Intersect> intersection;
 
-    intersection = intersect(scene, ray);
+    intersection = intersect(scene, ray, marchStart);
+    if(hitDistance != nullptr)
+        *hitDistance = intersection.has_value() ? intersection.value().t : std::numeric_limits<float>::infinity();
 
     if(intersection.has_value()){
         Intersect& inter = intersection.value();
         glm::vec4 point = ray.evaluate(inter.t);
         glm::vec4 directionToCamera = camera.getPosition() - point;
 
-        return toRGBA(computePixelLighting(point, glm::vec4{inter.normal, 0}, directionToCamera, inter.shape, 0, scene, *this));
+        return toRGBA(computePixelLighting(point, glm::vec4{inter.normal, 0}, directionToCamera, inter.shape, 0, m_context, scene, *this));
     } else {
         return DEFAULT_COLOR;
     }
@@ -83,9 +88,26 @@ RGBA RayTracer::raytrace(Ray ray, RayTraceScene& scene){
 void RayTracer::render(RGBA *imageData, RayTraceScene& scene, const float time) {
    // Update temporal data
     scene.updateTemporalData(time);
+    m_context.build(scene);
 
     const Camera& camera = scene.getCamera();
 
+    // Start each march near where the last frame hit, as long as the marched shapes haven't moved since
+    const bool reprojecting = rayMarchSettings.enabled && rayMarchSettings.temporalReprojection
+                              && !m_config.enableSuperSample;
+    if (reprojecting) {
+        if (scene.marchedShapesMoved())
+            m_marchDepth.reset(scene.width(), scene.height());
+        else
+            m_marchDepth.reproject(scene);
+    }
+
+    if (m_config.enableTextureMap)
+        preloadTextures(scene);
+
+    if (m_config.enableShadow && m_config.enableShadowMaps)
+        renderShadowMaps(scene);
+
     // Data for progress bar
     int barNumChars = 50;
     int pauseTimeMs = 700;
@@ -151,6 +173,10 @@ void RayTracer::render(RGBA *imageData, RayTraceScene& scene, const float time)
                 }
                 float points = SUPER_SAMPLE_FACTOR * SUPER_SAMPLE_FACTOR;
                 imageData[idx] = RGBA{clamp(racc/points), clamp(gacc/points), clamp(bacc/points), 0};
+            } else if (reprojecting) {
+                float hitDistance;
+                imageData[idx] = raytrace(ray, scene, m_marchDepth.startDistance(i, j), &hitDistance);
+                m_marchDepth.record(i, j, ray, hitDistance);
             } else {
                 imageData[idx] = raytrace(ray, scene);
             }
@@ -160,38 +186,73 @@ void RayTracer::render(RGBA *imageData, RayTraceScene& scene, const float time)
     }
 }
 
-void RayTracer::loadTexture(const SceneFileMap& fileMap) {
-
-    std::string path = fileMap.filename;
-    if(m_textures.contains(path)){
-        // Don't load the same texture twice
-        return;
+void RayTracer::printStats() {
+    OccluderCacheStats occluderStats = occluderCacheStats();
+    if (occluderStats.lookups > 0) {
+        std::cout << "Shadow occluder cache: " << occluderStats.hits << " / " << occluderStats.lookups << " hits ("
+                  << int(100.0 * occluderStats.hits / occluderStats.lookups) << " %)" << std::endl;
     }
-
-    QImage myImage;
-    if (!myImage.load(QString::fromStdString(path))) {
-        std::cout<<"Failed to load in image"<<std::endl;
-        return;
+    TextureTileStats tileStats = m_textures.tileStats();
+    if (tileStats.hits + tileStats.misses > 0) {
+        std::cout << "Texture tile cache: " << tileStats.hits << " hits, " << tileStats.misses << " misses ("
+                  << int(100.0 * tileStats.hits / (tileStats.hits + tileStats.misses)) << " % hits), "
+                  << tileStats.evictions << " evictions" << std::endl;
     }
-    myImage = myImage.convertToFormat(QImage::Format_RGBX8888);
-    int width = myImage.width();
-    int height = myImage.height();
-
-    QByteArray arr = QByteArray::fromRawData((const char*) myImage.bits(), myImage.sizeInBytes());
+    uint64_t droppedRays = droppedSecondaryRayCount();
+    if (droppedRays > 0) {
+        std::cout << "Secondary rays dropped (too many waiting in one pixel): " << droppedRays << std::endl;
+    }
+}
 
-    std::vector<RGBA> data;
+/**
+ * Renders a shadow map for each light that supports one. The maps only depend on the shapes and lights, so they're
+ * kept across the frames of an animation until a shape moves.
+ */
+void RayTracer::renderShadowMaps(const RayTraceScene& scene) {
+    if (m_shadowMapSceneId == scene.id() && !scene.shapesMoved())
+        return;
 
-    data.reserve(width * height);
-    for (int i = 0; i < arr.size() / 4.f; i++){
-        data.push_back(RGBA{(std::uint8_t) arr[4*i], (std::uint8_t) arr[4*i+1], (std::uint8_t) arr[4*i+2], (std::uint8_t) arr[4*i+3]});
+    const std::vector<SceneLightData>& lights = scene.getLights();
+    m_shadowMaps.assign(lights.size(), ShadowMap{});
+    for (int i = 0; i < lights.size(); i++) {
+        if (ShadowMap::supports(lights[i]) && !usesSoftShadowMarch(lights[i]))
+            m_shadowMaps[i].render(lights[i], scene, m_config.shadowMapResolution, m_config.enableParallelism);
     }
+    m_shadowMapSceneId = scene.id();
+}
 
-    m_textures[path] = Texture{width, height, data};
+const ShadowMap& RayTracer::getShadowMap(const SceneLightData& light, const RayTraceScene& scene) const {
+    const static ShadowMap NO_SHADOW_MAP{};
+    if (m_shadowMapSceneId != scene.id())
+        return NO_SHADOW_MAP;
+    return m_shadowMaps[scene.getLightIndex(light)];
 }
 
-Texture& RayTracer::getTexture(const SceneFileMap &fileMap){
-    if(!m_textures.contains(fileMap.filename))
-        loadTexture(fileMap);
+/**
+ * Loads the textures of the scene's shapes (and of the prototypes of its instances) before the render starts, so
+ * the first hits on them don't all wait on the cache's lock. Members of SDF groups still load theirs on first use.
+ */
+void RayTracer::preloadTextures(const RayTraceScene& scene) {
+    auto preload = [this](const Shape* shape) {
+        const SceneMaterial& material = *shape->m_material;
+        if (material.textureMap.isUsed && material.blend != 0)
+            m_textures.get(material.textureMap);
+    };
+
+    // Instances of the same object share their members, so each prototype only has to be gone through once
+    std::set<const std::vector<Shape*>*> prototypes;
+    for (const Shape* shape : scene.getShapes()) {
+        preload(shape);
+        if (!shape->isInstance())
+            continue;
+        const std::vector<Shape*>& members = static_cast<const InstanceShape*>(shape)->members();
+        if (prototypes.insert(&members).second) {
+            for (const Shape* member : members)
+                preload(member);
+        }
+    }
+}
 
-    return m_textures[fileMap.filename];
+const Texture* RayTracer::getTexture(const SceneFileMap& fileMap) {
+    return m_textures.get(fileMap);
 }
@@ -1,28 +1,25 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <map>
 #include <string>
 #include <vector>
 #include "utils/rgba.h"
 #include "utils/scenedata.h"
+#include "marchdepthbuffer.h"
+#include "rendercontext.h"
+#include "shadowmap.h"
+#include "texture.h"
 
 
 
 struct Ray{
     glm::vec4 p;
     glm::vec4 d;
-    glm::vec4 evaluate(float t){
+    glm::vec4 evaluate(float t) const {
         return p + t * d;
     }
 };
 
-struct Texture {
-    int width;
-    int height;
-    std::vector<RGBA> data;
-};
-
 // A forward declaration for the RaytraceScene class
 
 class RayTraceScene;
@@ -42,6 +39,22 @@ public:
         bool enableSuperSample   = false;
         bool enableAcceleration  = false;
         bool enableDepthOfField  = false;
+        bool enableShadowMaps    = false; // Shadows from directional and spot lights come from depth maps
+        int shadowMapResolution  = 1024;
+        // Reflections are only followed while they can add more than this to the pixel, unless Russian roulette
+        // lets them go on at random
+        float reflectionThreshold  = 1.0f / 256.0f;
+        bool enableRussianRoulette = false;
+        // Area lights first trace a 3x3 lattice of their samples, and only trace the rest of them when those disagree.
+        // Faster, but misses occluders that fall between the probes, so it's off by default.
+        bool enableAreaLightProbes = false;
+        // Scenes with many point and spot lights only evaluate a few of them at each point, sampled from a light
+        // tree. Much faster, but noisy instead of exact, so it's off by default.
+        bool enableLightTree = false;
+        // Textures stream through this much memory (in MB) from tile files preprocessed into textureCacheDir,
+        // rather than being kept in memory whole. 0 keeps them in memory.
+        int textureBudgetMB = 0;
+        std::string textureCacheDir = "texcache";
     };
 
 public:
@@ -52,14 +65,31 @@ public:
     // @param imageData The pointer to the imageData to be filled.
     // @param scene The scene to be rendered.
     void render(RGBA *imageData, RayTraceScene& scene, const float time = 0);
+    // Prints how the shadow occluder cache and the texture tile cache did, and how many secondary rays were dropped,
+    // over every render so far (only the ones with something to report)
+    void printStats();
 
-    RGBA raytrace(Ray ray, RayTraceScene& scene);
+    // marchStart is where marching along the ray may start. The distance to the hit (infinity for a miss) is
+    // written to hitDistance when it isn't null.
+    RGBA raytrace(Ray ray, RayTraceScene& scene, float marchStart = 0.0f, float* hitDistance = nullptr);
 
-    void loadTexture(const SceneFileMap& fileMap);
-    Texture& getTexture(const SceneFileMap& fileMap);
+    // The texture for the file map's image (nullptr if it can't be loaded). Safe to call while rendering.
+    const Texture* getTexture(const SceneFileMap& fileMap);
+    // The shadow map for one of the scene's lights (an empty map when the light doesn't have one)
+    const ShadowMap& getShadowMap(const SceneLightData& light, const RayTraceScene& scene) const;
     const Config m_config;
 private:
 
-    std::map<const std::string, Texture> m_textures;
+    TextureCache m_textures;
+    // The constants shading uses, rebuilt at the start of every frame
+    RenderContext m_context;
+    // Primary hits of the last frame, for temporal reprojection
+    MarchDepthBuffer m_marchDepth;
+    // One per light of the scene they were rendered for, kept until something in the scene moves
+    std::vector<ShadowMap> m_shadowMaps;
+    int m_shadowMapSceneId = -1;
+
+    void renderShadowMaps(const RayTraceScene& scene);
+    void preloadTextures(const RayTraceScene& scene);
 };
 
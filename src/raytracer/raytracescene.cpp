@@ -1,12 +1,24 @@
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <numeric>
 #include <stdexcept>
 #include "raytracescene.h"
 #include "camera/camera.h"
 #include "utils/sceneparser.h"
+#include "utils/raymarchsettings.h"
+#include "utils/fractalsettings.h"
+#include "shapes/fractal.h"
 
-RayTraceScene::RayTraceScene(int width, int height, const RenderData& metaData): m_camera{metaData.cameraData, height, width} {
-    m_renderData = metaData;
+RayTraceScene::RayTraceScene(int width, int height, RenderData metaData): m_camera{metaData.cameraData, height, width} {
+    static std::atomic<int> nextId = 0;
+    m_id = nextId++;
+    m_renderData = std::move(metaData);
     m_width = width;
     m_height = height;
+    partitionShapes();
+    attachSDFVolumes();
+    prepareLights();
 }
 
 const int& RayTraceScene::width() const {
@@ -25,6 +37,17 @@ const Camera& RayTraceScene::getCamera() const {
     return m_camera;
 }
 
+float RayTraceScene::pixelWidth(float distance) const {
+    float pixelAngle = 2.0f * std::tan(m_camera.getHeightAngle() / 2.0f) / m_height;
+    return pixelAngle * distance;
+}
+
+float RayTraceScene::pixelFootprint(float distance) const {
+    if (!fractalSettings.lodEnabled)
+        return 0.0f;
+    return pixelWidth(distance);
+}
+
 const std::vector<Shape*>& RayTraceScene::getShapes() const {
     return m_renderData.shapes;
 }
@@ -33,6 +56,125 @@ const std::vector<SceneLightData>& RayTraceScene::getLights() const {
     return m_renderData.lights;
 }
 
+const std::vector<Shape*>& RayTraceScene::getAnalyticShapes() const {
+    return m_analyticShapes;
+}
+
+const std::vector<Shape*>& RayTraceScene::getMarchedShapes() const {
+    return m_marchedShapes;
+}
+
+int RayTraceScene::getLightIndex(const SceneLightData& light) const {
+    return &light - m_renderData.lights.data();
+}
+
+const AreaLightSamples& RayTraceScene::getAreaLightSamples(const SceneLightData& light) const {
+    return m_areaLightSamples[getLightIndex(light)];
+}
+
+const std::vector<int>& RayTraceScene::getExplicitLights() const {
+    return m_explicitLights;
+}
+
+const LightTree& RayTraceScene::getLightTree() const {
+    return m_lightTree;
+}
+
+int RayTraceScene::id() const {
+    return m_id;
+}
+
+/**
+ * Which of the shapes come within mergeFactor of another one, the only way two shapes can blend. The shapes are
+ * swept in the order their bounding spheres start along the axis their centers are most spread out on, so each
+ * shape is only tested against the ones whose bounds reach it along that axis.
+ */
+static std::vector<bool> findBlendingShapes(const std::vector<Shape*>& shapes, float mergeFactor) {
+    std::vector<glm::vec3> centers(shapes.size());
+    std::vector<float> radii(shapes.size());
+    glm::vec3 lowest(std::numeric_limits<float>::infinity());
+    glm::vec3 highest(-std::numeric_limits<float>::infinity());
+    for (int i = 0; i < shapes.size(); i++) {
+        centers[i] = shapes[i]->getWorldBoundCenter();
+        radii[i] = shapes[i]->getWorldBoundRadius();
+        lowest = glm::min(lowest, centers[i]);
+        highest = glm::max(highest, centers[i]);
+    }
+
+    glm::vec3 spread = highest - lowest;
+    int axis = spread.x >= spread.y && spread.x >= spread.z ? 0 : (spread.y >= spread.z ? 1 : 2);
+
+    std::vector<int> order(shapes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return centers[a][axis] - radii[a] < centers[b][axis] - radii[b];
+    });
+
+    std::vector<bool> blending(shapes.size(), false);
+    for (int i = 0; i < order.size(); i++) {
+        int shape = order[i];
+        float end = centers[shape][axis] + radii[shape] + mergeFactor;
+        for (int j = i + 1; j < order.size(); j++) {
+            int other = order[j];
+            // The rest start even further along the axis
+            if (centers[other][axis] - radii[other] > end)
+                break;
+            float reach = radii[shape] + radii[other] + mergeFactor;
+            if (glm::distance(centers[shape], centers[other]) < reach) {
+                blending[shape] = true;
+                blending[other] = true;
+            }
+        }
+    }
+    return blending;
+}
+
+/**
+ * Splits the shapes into the ones that have to be ray marched (shapes without a closed form intersection,
+ * and shapes that can smooth merge with a neighbour) and the ones that can be intersected analytically. Without
+ * ray marching, every shape is intersected analytically.
+ */
+void RayTraceScene::partitionShapes() {
+    const std::vector<Shape*>& shapes = m_renderData.shapes;
+    m_marchedShapes.clear();
+    if (!rayMarchSettings.enabled) {
+        m_analyticShapes = shapes;
+        return;
+    }
+    m_analyticShapes.clear();
+
+    std::vector<bool> blending;
+    if (rayMarchSettings.hybrid && rayMarchSettings.smoothMergeEnabled)
+        blending = findBlendingShapes(shapes, rayMarchSettings.mergeFactor);
+
+    for (int i = 0; i < shapes.size(); i++) {
+        Shape* shape = shapes[i];
+        bool marched = !rayMarchSettings.hybrid || shape->requiresMarching() || (!blending.empty() && blending[i]);
+        if (marched)
+            m_marchedShapes.push_back(shape);
+        else
+            m_analyticShapes.push_back(shape);
+    }
+}
+
+/**
+ * Bakes (or loads) a volume for every fractal when the volume cache is on. Fractals never change shape over time,
+ * only their CTMs move, so the object space volumes stay valid for the whole animation.
+ */
+void RayTraceScene::attachSDFVolumes() {
+    if (!rayMarchSettings.enabled || !fractalSettings.volumeCacheEnabled)
+        return;
+
+    for (Shape* shape : m_renderData.shapes) {
+        Fractal* fractal = dynamic_cast<Fractal*>(shape);
+        if (fractal == nullptr)
+            continue;
+        fractal->setVolume(SDFVolume::loadOrBake(*fractal, fractal->volumeKey(),
+                                                 fractalSettings.volumeCacheDir,
+                                                 fractalSettings.volumeResolution));
+    }
+}
+
 void RayTraceScene::updateTemporalData(const float time){
     // Update camera position and rotation
     m_camera.update(time);
@@ -40,9 +182,122 @@ void RayTraceScene::updateTemporalData(const float time){
     // LATER: Update shape CTMs if they are temporal
 
     // for each shape in scene
+    m_shapesMoved = false;
+    m_marchedShapesMoved = false;
     for (Shape* shape : m_renderData.shapes) {
+        glm::mat4 previousCtm = shape->m_ctm;
         shape->updatePosition(time);
+        if (shape->m_ctm != previousCtm)
+            m_shapesMoved = true;
+        if (shape->m_ctm != previousCtm && (!rayMarchSettings.hybrid || shape->requiresMarching()
+                                            || rayMarchSettings.smoothMergeEnabled))
+            m_marchedShapesMoved = true;
+    }
+
+    // Moving shapes may have started (or stopped) overlapping
+    if (m_shapesMoved)
+        partitionShapes();
+
+    // Lights don't change over time, so the light tree and area light samples built with the scene hold for every
+    // frame
+}
+
+bool RayTraceScene::shapesMoved() const {
+    return m_shapesMoved;
+}
+
+bool RayTraceScene::marchedShapesMoved() const {
+    return m_marchedShapesMoved;
+}
+
+// Spacing of the sample grid on area lights
+const static float AREA_LIGHT_INTERVAL = 0.1;
+// Scenes with at least this many point and spot lights get a light tree to sample them from (when the ray tracer's
+// enableLightTree is on) instead of evaluating each
+const static int LIGHT_TREE_MIN_LIGHTS = 64;
+
+/**
+ * Works out everything about the lights that doesn't depend on the shaded point, once per scene.
+ */
+void RayTraceScene::prepareLights() {
+    const std::vector<SceneLightData>& lights = m_renderData.lights;
+    std::vector<int> treeLights;
+    for (int i = 0; i < lights.size(); i++) {
+        if (lights[i].type == LightType::LIGHT_POINT || lights[i].type == LightType::LIGHT_SPOT)
+            treeLights.push_back(i);
     }
 
+    m_explicitLights.clear();
+    if (treeLights.size() >= LIGHT_TREE_MIN_LIGHTS) {
+        m_lightTree.build(lights, treeLights);
+        for (int i = 0; i < lights.size(); i++) {
+            if (lights[i].type != LightType::LIGHT_POINT && lights[i].type != LightType::LIGHT_SPOT)
+                m_explicitLights.push_back(i);
+        }
+    } else {
+        m_lightTree.build(lights, {});
+        for (int i = 0; i < lights.size(); i++) {
+            m_explicitLights.push_back(i);
+        }
+    }
+
+    placeAreaLightSamples();
+}
+
+/**
+ * Lays out the grid of shadow ray targets on each area light, once per scene instead of once per shaded point.
+ */
+void RayTraceScene::placeAreaLightSamples() {
+    m_areaLightSamples.assign(m_renderData.lights.size(), AreaLightSamples{});
 
+    for (int i = 0; i < m_renderData.lights.size(); i++) {
+        const SceneLightData& light = m_renderData.lights[i];
+        if (light.type != LightType::LIGHT_AREA)
+            continue;
+
+        float lightWidthRadius = light.width / 2;
+        float lightHeightRadius = light.height / 2;
+        glm::vec3 up {0, 1, 0};
+
+        glm::vec3 pos = light.pos;
+        glm::vec3 look = light.dir;
+
+        glm::mat4 translate = glm::mat4{
+          1,0,0,0,
+          0,1,0,0,
+          0,0,1,0,
+          -pos.x, -pos.y, -pos.z, 1
+        };
+
+        glm::vec3 w = -glm::normalize(look);
+        glm::vec3 v = glm::normalize(up - glm::dot(up, w) * w);
+        glm::vec3 u = glm::cross(v, w);
+        glm::mat4 rotate = glm::mat4{u.x, v.x, w.x, 0,
+                                     u.y, v.y, w.y, 0,
+                                     u.z, v.z, w.z, 0,
+                                     0, 0, 0, 1};
+        glm::mat4 lightSpaceCTM = glm::inverse(rotate * translate);
+
+        AreaLightSamples& samples = m_areaLightSamples[i];
+        for(float widthOffset = -lightWidthRadius; widthOffset < lightWidthRadius; widthOffset += AREA_LIGHT_INTERVAL){
+            samples.columns = 0;
+            for(float heightOffset = -lightHeightRadius; heightOffset < lightHeightRadius; heightOffset += AREA_LIGHT_INTERVAL){
+                samples.points.push_back(lightSpaceCTM * glm::vec4{0, widthOffset, heightOffset, 1});
+                samples.columns++;
+            }
+        }
+
+        if (samples.points.empty())
+            continue;
+        int rows = samples.points.size() / samples.columns;
+        int rowStrata = std::min(rows, AREA_LIGHT_PROBE_STRATA);
+        int columnStrata = std::min(samples.columns, AREA_LIGHT_PROBE_STRATA);
+        for (int r = 0; r < rowStrata; r++) {
+            for (int c = 0; c < columnStrata; c++) {
+                int row = rowStrata > 1 ? r * (rows - 1) / (rowStrata - 1) : rows / 2;
+                int column = columnStrata > 1 ? c * (samples.columns - 1) / (columnStrata - 1) : samples.columns / 2;
+                samples.probes.push_back(row * samples.columns + column);
+            }
+        }
+    }
 }
@@ -3,6 +3,21 @@
 #include "utils/scenedata.h"
 #include "utils/sceneparser.h"
 #include "camera/camera.h"
+#include "lighttree.h"
+
+// Area light probes are an AREA_LIGHT_PROBE_STRATA x AREA_LIGHT_PROBE_STRATA lattice of the light's samples, spread
+// evenly from corner to corner, so every stratum between them has a probe at each of its corners (lights with fewer
+// rows or columns than that get fewer)
+const int AREA_LIGHT_PROBE_STRATA = 3;
+
+// Points on an area light that shadow rays are traced to, in world space. The points form a grid of rows with
+// `columns` points each.
+struct AreaLightSamples {
+    std::vector<glm::vec4> points;
+    int columns = 0;
+    // The probes (indices into points), row by row
+    std::vector<int> probes;
+};
 
 // A class representing a scene to be ray-traced
 class RayTraceScene
@@ -11,11 +26,30 @@ private:
 
     int m_width;
     int m_height;
+    int m_id; // Unique across all scenes ever created in this process
     RenderData m_renderData;
     Camera m_camera;
 
+    // Shapes intersected in closed form vs. by ray marching (when ray marching is enabled)
+    std::vector<Shape*> m_analyticShapes;
+    std::vector<Shape*> m_marchedShapes;
+    // Whether any shape, and whether a marched shape, moved in the last updateTemporalData
+    bool m_shapesMoved = false;
+    bool m_marchedShapesMoved = false;
+    // One per light (empty for lights that aren't area lights)
+    std::vector<AreaLightSamples> m_areaLightSamples;
+    // Scenes with many point and spot lights sample them from the tree, the other lights are always evaluated
+    LightTree m_lightTree;
+    std::vector<int> m_explicitLights;
+
+    void partitionShapes();
+    void prepareLights();
+    void placeAreaLightSamples();
+    void attachSDFVolumes();
+
 public:
-    RayTraceScene(int width, int height, const RenderData &metaData);
+    // Takes over the parsed scene (move it in to avoid copying it)
+    RayTraceScene(int width, int height, RenderData metaData);
 
     // The getter of the width of the scene
     const int& width() const;
@@ -28,11 +62,28 @@ public:
 
     const std::vector<Shape*>& getShapes() const;
     const std::vector<SceneLightData>& getLights() const;
+    const std::vector<Shape*>& getAnalyticShapes() const;
+    const std::vector<Shape*>& getMarchedShapes() const;
+    // light must be one of getLights()
+    int getLightIndex(const SceneLightData& light) const;
+    const AreaLightSamples& getAreaLightSamples(const SceneLightData& light) const;
+    // The lights (indices into getLights()) to evaluate at every point, and the tree to sample the rest from
+    const std::vector<int>& getExplicitLights() const;
+    const LightTree& getLightTree() const;
+
+    int id() const;
 
     // The getter of the shared pointer to the camera instance of the scene
     const Camera& getCamera() const;
 
+    // The world space width of one pixel at the given distance from the eye
+    float pixelWidth(float distance) const;
+    // Same as above, but 0 when fractal LOD is off
+    float pixelFootprint(float distance) const;
+
     void updateTemporalData(const float time);
+    bool shapesMoved() const;
+    bool marchedShapesMoved() const;
 };
 
 
@@ -0,0 +1,54 @@
+#include <cmath>
+#include <limits>
+#include "rendercontext.h"
+#include "raytracescene.h"
+
+// Lights are culled where they'd add less than this to any color channel (half a step of 8-bit color)
+const static float MIN_LIGHT_CONTRIBUTION = 1.0f / 512.0f;
+
+/**
+ * The distance beyond which the light's attenuated color stays below MIN_LIGHT_CONTRIBUTION (infinity if it never
+ * does). Area lights are measured from their center, so their radius also covers their extent.
+ */
+static float influenceRadius(const SceneLightData& light) {
+    if (light.type == LightType::LIGHT_DIRECTIONAL)
+        return std::numeric_limits<float>::infinity();
+
+    // Solve a + b d + c d^2 = brightest / MIN_LIGHT_CONTRIBUTION for d
+    float brightest = std::max(light.color.r, std::max(light.color.g, light.color.b));
+    float limit = brightest / MIN_LIGHT_CONTRIBUTION;
+    float a = light.function.x, b = light.function.y, c = light.function.z;
+    float radius;
+    if (a >= limit) {
+        radius = 0.0f;
+    } else if (c > 0) {
+        radius = (-b + std::sqrt(b * b + 4.0f * c * (limit - a))) / (2.0f * c);
+    } else if (b > 0) {
+        radius = (limit - a) / b;
+    } else {
+        return std::numeric_limits<float>::infinity();
+    }
+
+    if (light.type == LightType::LIGHT_AREA)
+        radius += std::sqrt(light.width * light.width + light.height * light.height) / 2.0f;
+    return radius;
+}
+
+void RenderContext::build(const RayTraceScene& scene) {
+    globalData = scene.getGlobalData();
+
+    const std::vector<SceneLightData>& sceneLights = scene.getLights();
+    lights.resize(sceneLights.size());
+    for (int i = 0; i < sceneLights.size(); i++) {
+        const SceneLightData& light = sceneLights[i];
+        LightContext& context = lights[i];
+        context.light = &light;
+        context.direction = light.type == LightType::LIGHT_POINT ? glm::vec4(0) : glm::normalize(light.dir);
+        context.influenceRadius = influenceRadius(light);
+
+        // A penumbra wider than the cone leaves no fully lit inner cone
+        float inner = light.angle - light.penumbra;
+        context.cosInner = inner >= 0 ? std::cos(inner) : std::numeric_limits<float>::infinity();
+        context.cosOuter = std::cos(light.angle);
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/scenedata.h"
+
+class RayTraceScene;
+
+// The constants of one light that shading would otherwise work out again at every point
+struct LightContext {
+    const SceneLightData* light;
+    glm::vec4 direction;   // The light's direction, normalized (directional and spot lights)
+    float influenceRadius; // Beyond this distance, the light's contribution is too small to matter
+    // Cosines of a spot light's inner and outer cone angles: points inside the inner cone get all of the light, and
+    // points outside the outer one none of it
+    float cosInner;
+    float cosOuter;
+};
+
+/**
+ * The constants of a frame that shading uses at every point, flattened into arrays. It's built once per frame, after
+ * the scene's temporal data is updated, and doesn't change while the frame renders, so every rendering thread shades
+ * with the same context by reference.
+ */
+struct RenderContext {
+    std::vector<LightContext> lights; // One per scene light, in the same order
+    SceneGlobalData globalData;
+
+    void build(const RayTraceScene& scene);
+};
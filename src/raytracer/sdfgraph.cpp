@@ -0,0 +1,248 @@
+#include <stdexcept>
+#include "sdfgraph.h"
+#include "shape.h"
+#include "utils/raymarchfuncs.h"
+#include "utils/raymarchsettings.h"
+
+static bool isIdentity(const glm::mat4& m) {
+    return m == glm::mat4(1);
+}
+
+/**
+ * Returns a simplified copy of node that evaluates to the same distance.
+ */
+static SDFNode fold(const SDFNode& node) {
+    SDFNode folded = node;
+    folded.children.clear();
+    for (const SDFNode& child : node.children) {
+        folded.children.push_back(fold(child));
+    }
+
+    switch (folded.type) {
+    case SDFNodeType::SDF_LEAF:
+        return folded;
+    case SDFNodeType::SDF_TRANSFORM: {
+        SDFNode& child = folded.children[0];
+        if (child.type == SDFNodeType::SDF_TRANSFORM) {
+            // The child's inverse is applied after ours
+            child.inverse = child.inverse * folded.inverse;
+            return isIdentity(child.inverse) ? child.children[0] : child;
+        }
+        if (isIdentity(folded.inverse))
+            return child;
+        return folded;
+    }
+    case SDFNodeType::SDF_REPEAT:
+        if (folded.period == glm::vec3(0))
+            return folded.children[0];
+        return folded;
+    case SDFNodeType::SDF_COMBINE:
+        break;
+    }
+
+    // A smooth union that doesn't blend is a plain union
+    if (folded.operation == SDFOperationType::SDF_SMOOTH_UNION && folded.k <= 0)
+        folded.operation = SDFOperationType::SDF_UNION;
+
+    // Unions of unions (and intersections of intersections) can be flattened, as can a subtraction whose
+    // first member is itself a subtraction. Smooth unions can't, since blending is not associative.
+    if (folded.operation != SDFOperationType::SDF_SMOOTH_UNION) {
+        std::vector<SDFNode> flattened;
+        for (int i = 0; i < folded.children.size(); i++) {
+            SDFNode& child = folded.children[i];
+            bool sameOperation = child.type == SDFNodeType::SDF_COMBINE && child.operation == folded.operation;
+            bool canFlatten = folded.operation != SDFOperationType::SDF_SUBTRACTION || i == 0;
+            if (sameOperation && canFlatten) {
+                flattened.insert(flattened.end(), child.children.begin(), child.children.end());
+            } else {
+                flattened.push_back(std::move(child));
+            }
+        }
+        folded.children = std::move(flattened);
+    }
+
+    if (folded.children.size() == 1)
+        return folded.children[0];
+    return folded;
+}
+
+// Hands out the lowest free register, keeping track of how many are needed in total
+class RegisterAllocator {
+public:
+    int allocate() {
+        for (int i = 0; i < m_used.size(); i++) {
+            if (!m_used[i]) {
+                m_used[i] = true;
+                return i;
+            }
+        }
+        if (m_used.size() == SDFTape::MAX_REGISTERS)
+            throw std::runtime_error("SDF graph is too deep to compile");
+        m_used.push_back(true);
+        return m_used.size() - 1;
+    }
+
+    void release(int reg) {
+        m_used[reg] = false;
+    }
+
+private:
+    std::vector<bool> m_used;
+};
+
+struct SDFCompiler {
+    std::vector<SDFInstruction> instructions;
+    std::vector<const Shape*> leaves;
+    std::vector<glm::mat4> matrices;
+    std::vector<glm::vec3> periods;
+    RegisterAllocator pointRegisters;
+    RegisterAllocator distanceRegisters;
+
+    /**
+     * Emits the instructions evaluating node at the point in pointRegister, and returns the distance register
+     * holding the result. scale converts distances in node's space to the root's space (leaves also divide by
+     * their Lipschitz bound), footprintScale converts footprints the other way.
+     */
+    int emit(const SDFNode& node, int pointRegister, float scale, float footprintScale) {
+        switch (node.type) {
+        case SDFNodeType::SDF_LEAF: {
+            int dst = distanceRegisters.allocate();
+            instructions.push_back({SDFOpcode::LEAF, (unsigned char)dst, (unsigned char)pointRegister, 0,
+                                    (int)leaves.size(), scale / node.leaf->lipschitzBound(), footprintScale});
+            leaves.push_back(node.leaf);
+            return dst;
+        }
+        case SDFNodeType::SDF_TRANSFORM: {
+            int point = pointRegisters.allocate();
+            instructions.push_back({SDFOpcode::TRANSFORM, (unsigned char)point, (unsigned char)pointRegister, 0,
+                                    (int)matrices.size(), 0.0f, 0.0f});
+            matrices.push_back(node.inverse);
+
+            // Distances shrink by at most the inverse's largest stretch, and detail grows by at most the
+            // transform's largest stretch
+            float childScale = 1.0f / Shape::maxStretch(glm::mat3(node.inverse));
+            float childFootprintScale = 1.0f / Shape::maxStretch(glm::mat3(glm::inverse(node.inverse)));
+            int result = emit(node.children[0], point, scale * childScale, footprintScale * childFootprintScale);
+            pointRegisters.release(point);
+            return result;
+        }
+        case SDFNodeType::SDF_REPEAT: {
+            int point = pointRegisters.allocate();
+            instructions.push_back({SDFOpcode::REPEAT, (unsigned char)point, (unsigned char)pointRegister, 0,
+                                    (int)periods.size(), 0.0f, 0.0f});
+            periods.push_back(node.period);
+            int result = emit(node.children[0], point, scale, footprintScale);
+            pointRegisters.release(point);
+            return result;
+        }
+        case SDFNodeType::SDF_COMBINE:
+            break;
+        }
+
+        if (node.children.empty())
+            throw std::invalid_argument("SDF group has no members");
+
+        SDFOpcode opcode = SDFOpcode::UNION;
+        switch (node.operation) {
+        case SDFOperationType::SDF_UNION:        opcode = SDFOpcode::UNION; break;
+        case SDFOperationType::SDF_SMOOTH_UNION: opcode = SDFOpcode::SMOOTH_UNION; break;
+        case SDFOperationType::SDF_INTERSECTION: opcode = SDFOpcode::INTERSECTION; break;
+        case SDFOperationType::SDF_SUBTRACTION:  opcode = SDFOpcode::SUBTRACTION; break;
+        }
+
+        int result = emit(node.children[0], pointRegister, scale, footprintScale);
+        for (int i = 1; i < node.children.size(); i++) {
+            int other = emit(node.children[i], pointRegister, scale, footprintScale);
+            instructions.push_back({opcode, (unsigned char)result, (unsigned char)result, (unsigned char)other,
+                                    0, node.k * scale, 0.0f});
+            distanceRegisters.release(other);
+        }
+        return result;
+    }
+};
+
+SDFTape SDFTape::compile(const SDFNode& root) {
+    SDFCompiler compiler;
+    int input = compiler.pointRegisters.allocate();
+    int result = compiler.emit(fold(root), input, 1.0f, 1.0f);
+    // The evaluator reads its input from point register 0 and its result from distance register 0
+    if (input != 0 || result != 0)
+        throw std::logic_error("SDF tape input and result must be in register 0");
+
+    SDFTape tape;
+    tape.m_instructions = std::move(compiler.instructions);
+    tape.m_leaves = std::move(compiler.leaves);
+    tape.m_matrices = std::move(compiler.matrices);
+    tape.m_periods = std::move(compiler.periods);
+    return tape;
+}
+
+float SDFTape::evaluate(glm::vec4 p, float footprint) const {
+    return run<false>(p, footprint, nullptr);
+}
+
+float SDFTape::evaluate(glm::vec4 p, float footprint, int& leafIndex) const {
+    return run<true>(p, footprint, &leafIndex);
+}
+
+const std::vector<const Shape*>& SDFTape::leaves() const {
+    return m_leaves;
+}
+
+const std::vector<SDFInstruction>& SDFTape::instructions() const {
+    return m_instructions;
+}
+
+template <bool trackLeaves>
+float SDFTape::run(glm::vec4 point, float footprint, int* leafIndex) const {
+    glm::vec4 p[MAX_REGISTERS];
+    float d[MAX_REGISTERS];
+    int leaf[trackLeaves ? MAX_REGISTERS : 1];
+
+    // Picks d[a] or d[b] (and the leaf that produced it) into d[dst]
+    auto select = [&](const SDFInstruction& in, bool pickB, float value) {
+        if constexpr (trackLeaves)
+            leaf[in.dst] = pickB ? leaf[in.b] : leaf[in.a];
+        d[in.dst] = value;
+    };
+
+    p[0] = point;
+    for (const SDFInstruction& in : m_instructions) {
+        switch (in.opcode) {
+        case SDFOpcode::LEAF:
+            d[in.dst] = m_leaves[in.constant]->shapeSDFLod(p[in.a], footprint * in.footprintScale) * in.k;
+            if constexpr (trackLeaves)
+                leaf[in.dst] = in.constant;
+            break;
+        case SDFOpcode::TRANSFORM:
+            p[in.dst] = m_matrices[in.constant] * p[in.a];
+            break;
+        case SDFOpcode::REPEAT: {
+            const glm::vec3& period = m_periods[in.constant];
+            glm::vec4 q = p[in.a];
+            for (int axis = 0; axis < 3; axis++) {
+                if (period[axis] > 0)
+                    q[axis] -= period[axis] * std::round(q[axis] / period[axis]);
+            }
+            p[in.dst] = q;
+            break;
+        }
+        case SDFOpcode::UNION:
+            select(in, d[in.b] < d[in.a], std::min(d[in.a], d[in.b]));
+            break;
+        case SDFOpcode::SMOOTH_UNION:
+            select(in, d[in.b] < d[in.a], smoothPolyMin2(d[in.a], d[in.b], in.k, rayMarchSettings.polyExponent)[0]);
+            break;
+        case SDFOpcode::INTERSECTION:
+            select(in, d[in.b] > d[in.a], std::max(d[in.a], d[in.b]));
+            break;
+        case SDFOpcode::SUBTRACTION:
+            select(in, -d[in.b] > d[in.a], std::max(d[in.a], -d[in.b]));
+            break;
+        }
+    }
+
+    if constexpr (trackLeaves)
+        *leafIndex = leaf[0];
+    return d[0];
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/scenedata.h"
+
+class Shape; // Forward ref
+
+enum class SDFNodeType {
+    SDF_LEAF,      // A shape, evaluated at the incoming point
+    SDF_TRANSFORM, // Evaluates its child at inverse * point
+    SDF_REPEAT,    // Evaluates its child with the point wrapped into one period
+    SDF_COMBINE    // Combines its children with an SDFOperationType
+};
+
+/**
+ * A node of an SDF expression graph. Points flow down from the root through transforms and repetitions,
+ * distances flow back up through the combine nodes.
+ */
+struct SDFNode {
+    SDFNodeType type = SDFNodeType::SDF_COMBINE;
+
+    const Shape* leaf = nullptr;                // SDF_LEAF
+    glm::mat4 inverse = glm::mat4(1);           // SDF_TRANSFORM
+    glm::vec3 period = glm::vec3(0);            // SDF_REPEAT
+    SDFOperationType operation = SDFOperationType::SDF_UNION; // SDF_COMBINE
+    float k = 0.0f;                             // SDF_COMBINE, smooth unions only
+
+    std::vector<SDFNode> children;
+};
+
+enum class SDFOpcode : unsigned char {
+    LEAF,          // d[dst] = leaf(p[a]) * scale
+    TRANSFORM,     // p[dst] = matrix * p[a]
+    REPEAT,        // p[dst] = p[a] wrapped into one period
+    UNION,         // d[dst] = min(d[a], d[b])
+    SMOOTH_UNION,  // d[dst] = smooth min(d[a], d[b]) with blend distance k
+    INTERSECTION,  // d[dst] = max(d[a], d[b])
+    SUBTRACTION    // d[dst] = max(d[a], -d[b])
+};
+
+struct SDFInstruction {
+    SDFOpcode opcode;
+    unsigned char dst;
+    unsigned char a;
+    unsigned char b;
+    int constant;  // Index into the tape's leaves, matrices or periods
+    float k;       // LEAF: distance scale, SMOOTH_UNION: blend distance
+    float footprintScale; // LEAF: converts a footprint to the leaf's object space
+};
+
+/**
+ * An SDF graph compiled into a flat list of instructions over a small set of point and distance registers.
+ *
+ * Compiling folds the graph first: chains of transforms become one matrix, identity transforms and empty
+ * repetitions disappear, single member groups are replaced by their member, and nested groups with the same
+ * (non-smooth) operation are flattened. Scales are pushed down into the leaves, so no instruction has to
+ * rescale a distance on the way back up.
+ */
+class SDFTape {
+public:
+    // The most registers of each kind a tape may use (deeper graphs fail to compile)
+    static const int MAX_REGISTERS = 32;
+
+    // Throws std::runtime_error if the graph needs more than MAX_REGISTERS registers, and std::invalid_argument if
+    // it has an empty group
+    static SDFTape compile(const SDFNode& root);
+
+    // The distance from p to the surface, resolving detail down to footprint (both in the root's space)
+    float evaluate(glm::vec4 p, float footprint) const;
+    // Same as evaluate, but also returns the index (into leaves()) of the leaf that decided the distance
+    float evaluate(glm::vec4 p, float footprint, int& leafIndex) const;
+
+    const std::vector<const Shape*>& leaves() const;
+    const std::vector<SDFInstruction>& instructions() const;
+
+private:
+    std::vector<SDFInstruction> m_instructions;
+    std::vector<const Shape*> m_leaves;
+    std::vector<glm::mat4> m_matrices;
+    std::vector<glm::vec3> m_periods;
+
+    template <bool trackLeaves>
+    float run(glm::vec4 p, float footprint, int* leafIndex) const;
+};
@@ -0,0 +1,219 @@
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include "sdfvolume.h"
+
+const static int SAMPLES_PER_EDGE = SDFVolume::BRICK_CELLS + 1;
+const static int SAMPLES_PER_BRICK = SAMPLES_PER_EDGE * SAMPLES_PER_EDGE * SAMPLES_PER_EDGE;
+// Number of points handed to shapeSDFBatch at once when baking brick centers
+const static int BAKE_CHUNK = 64;
+
+const static char FILE_MAGIC[4] = {'S', 'D', 'F', 'V'};
+// Bump whenever the file layout or the fractal SDFs change, so stale caches get rebaked
+const static int FILE_VERSION = 1;
+
+struct SDFVolumeFileHeader {
+    char magic[4];
+    int version;
+    int bricksPerAxis;
+    float extent;
+    int numSampledBricks;
+};
+
+std::shared_ptr<SDFVolume> SDFVolume::bake(const Shape& shape, int resolution) {
+    auto volume = std::make_shared<SDFVolume>();
+    const int bricksPerAxis = std::max(1, (resolution + BRICK_CELLS - 1) / BRICK_CELLS);
+    volume->m_bricksPerAxis = bricksPerAxis;
+    volume->m_extent = shape.boundingRadius();
+    volume->m_cellSize = 2.0f * volume->m_extent / (bricksPerAxis * BRICK_CELLS);
+
+    // Coarse pass: the distance at every brick center
+    const int numBricks = bricksPerAxis * bricksPerAxis * bricksPerAxis;
+    std::vector<glm::vec4> centers(numBricks);
+    for (int bz = 0; bz < bricksPerAxis; bz++)
+        for (int by = 0; by < bricksPerAxis; by++)
+            for (int bx = 0; bx < bricksPerAxis; bx++)
+                centers[(bz * bricksPerAxis + by) * bricksPerAxis + bx] = glm::vec4(volume->brickCenter(bx, by, bz), 1.0f);
+
+    volume->m_brickCenterDistances.resize(numBricks);
+    #pragma omp parallel for schedule(dynamic)
+    for (int start = 0; start < numBricks; start += BAKE_CHUNK) {
+        shape.shapeSDFBatch(&centers[start], &volume->m_brickCenterDistances[start],
+                            std::min(BAKE_CHUNK, numBricks - start), 0.0f);
+    }
+
+    // Refine the bricks that the surface could pass through
+    const float brickHalfDiagonal = std::sqrt(3.0f) * BRICK_CELLS * volume->m_cellSize / 2.0f;
+    std::vector<int> sampledBricks;
+    volume->m_brickOffsets.assign(numBricks, -1);
+    for (int brick = 0; brick < numBricks; brick++) {
+        if (volume->m_brickCenterDistances[brick] > brickHalfDiagonal)
+            continue;
+        volume->m_brickOffsets[brick] = sampledBricks.size() * SAMPLES_PER_BRICK;
+        sampledBricks.push_back(brick);
+    }
+
+    volume->m_samples.resize(sampledBricks.size() * SAMPLES_PER_BRICK);
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < sampledBricks.size(); i++) {
+        int brick = sampledBricks[i];
+        glm::ivec3 brickCoords{brick % bricksPerAxis, (brick / bricksPerAxis) % bricksPerAxis, brick / (bricksPerAxis * bricksPerAxis)};
+        glm::vec3 brickMin = glm::vec3(brickCoords * BRICK_CELLS) * volume->m_cellSize - volume->m_extent;
+
+        std::vector<glm::vec4> points(SAMPLES_PER_BRICK);
+        for (int sz = 0; sz < SAMPLES_PER_EDGE; sz++)
+            for (int sy = 0; sy < SAMPLES_PER_EDGE; sy++)
+                for (int sx = 0; sx < SAMPLES_PER_EDGE; sx++)
+                    points[(sz * SAMPLES_PER_EDGE + sy) * SAMPLES_PER_EDGE + sx] =
+                        glm::vec4(brickMin + glm::vec3(sx, sy, sz) * volume->m_cellSize, 1.0f);
+
+        shape.shapeSDFBatch(points.data(), &volume->m_samples[volume->m_brickOffsets[brick]], SAMPLES_PER_BRICK, 0.0f);
+    }
+
+    return volume;
+}
+
+std::shared_ptr<const SDFVolume> SDFVolume::loadOrBake(const Shape& shape, const std::string& key,
+                                                       const std::string& cacheDir, int resolution) {
+    static std::mutex cacheMutex;
+    static std::map<std::string, std::shared_ptr<const SDFVolume>> loadedVolumes;
+
+    const int bricksPerAxis = std::max(1, (resolution + BRICK_CELLS - 1) / BRICK_CELLS);
+    const std::string name = key + "-" + std::to_string(bricksPerAxis * BRICK_CELLS);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto loaded = loadedVolumes.find(name);
+    if (loaded != loadedVolumes.end())
+        return loaded->second;
+
+    const std::string path = (std::filesystem::path(cacheDir) / (name + ".sdfv")).string();
+    std::shared_ptr<SDFVolume> volume = load(path);
+    if (volume && (volume->m_bricksPerAxis != bricksPerAxis || volume->m_extent != shape.boundingRadius()))
+        volume = nullptr;
+
+    if (!volume) {
+        std::cout << "Baking SDF volume \"" << name << "\"..." << std::endl;
+        volume = bake(shape, resolution);
+
+        std::error_code error;
+        std::filesystem::create_directories(cacheDir, error);
+        if (!volume->save(path))
+            std::cerr << "Warning: could not save SDF volume to \"" << path << "\"" << std::endl;
+    }
+
+    loadedVolumes[name] = volume;
+    return volume;
+}
+
+std::shared_ptr<SDFVolume> SDFVolume::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+
+    SDFVolumeFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0
+        || header.version != FILE_VERSION
+        || header.bricksPerAxis <= 0
+        || header.numSampledBricks < 0)
+        return nullptr;
+
+    auto volume = std::make_shared<SDFVolume>();
+    volume->m_bricksPerAxis = header.bricksPerAxis;
+    volume->m_extent = header.extent;
+    volume->m_cellSize = 2.0f * header.extent / (header.bricksPerAxis * BRICK_CELLS);
+
+    const int numBricks = header.bricksPerAxis * header.bricksPerAxis * header.bricksPerAxis;
+    volume->m_brickCenterDistances.resize(numBricks);
+    volume->m_brickOffsets.resize(numBricks);
+    volume->m_samples.resize(header.numSampledBricks * SAMPLES_PER_BRICK);
+    file.read(reinterpret_cast<char*>(volume->m_brickCenterDistances.data()), numBricks * sizeof(float));
+    file.read(reinterpret_cast<char*>(volume->m_brickOffsets.data()), numBricks * sizeof(int));
+    file.read(reinterpret_cast<char*>(volume->m_samples.data()), volume->m_samples.size() * sizeof(float));
+    if (!file)
+        return nullptr;
+
+    for (int offset : volume->m_brickOffsets) {
+        if (offset < -1 || offset + SAMPLES_PER_BRICK > (int)volume->m_samples.size())
+            return nullptr;
+    }
+
+    return volume;
+}
+
+bool SDFVolume::save(const std::string& path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+
+    SDFVolumeFileHeader header;
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.bricksPerAxis = m_bricksPerAxis;
+    header.extent = m_extent;
+    header.numSampledBricks = m_samples.size() / SAMPLES_PER_BRICK;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(m_brickCenterDistances.data()), m_brickCenterDistances.size() * sizeof(float));
+    file.write(reinterpret_cast<const char*>(m_brickOffsets.data()), m_brickOffsets.size() * sizeof(int));
+    file.write(reinterpret_cast<const char*>(m_samples.data()), m_samples.size() * sizeof(float));
+    return bool(file);
+}
+
+float SDFVolume::lowerBound(glm::vec3 p) const {
+    // Points outside the cube are at least as far from the surface as from the cube (the surface is inside it),
+    // and at most that much closer than the nearest point on the cube
+    glm::vec3 q = glm::clamp(p, glm::vec3(-m_extent), glm::vec3(m_extent));
+    float outside = glm::distance(p, q);
+
+    glm::vec3 cells = (q + m_extent) / m_cellSize;
+    glm::ivec3 brickCoords = glm::clamp(glm::ivec3(glm::floor(cells / float(BRICK_CELLS))), 0, m_bricksPerAxis - 1);
+    int brick = (brickCoords.z * m_bricksPerAxis + brickCoords.y) * m_bricksPerAxis + brickCoords.x;
+
+    return std::max(outside, brickLowerBound(brick, brickCoords, q) - outside);
+}
+
+float SDFVolume::brickLowerBound(int brick, glm::ivec3 brickCoords, glm::vec3 p) const {
+    int offset = m_brickOffsets[brick];
+    if (offset < 0) {
+        // Far from the surface: the SDF changes by at most the distance moved from the brick center
+        return m_brickCenterDistances[brick] - glm::distance(p, brickCenter(brickCoords.x, brickCoords.y, brickCoords.z));
+    }
+
+    glm::vec3 local = glm::clamp((p + m_extent) / m_cellSize - glm::vec3(brickCoords * BRICK_CELLS), 0.0f, float(BRICK_CELLS));
+    glm::ivec3 cell = glm::min(glm::ivec3(local), BRICK_CELLS - 1);
+    glm::vec3 f = local - glm::vec3(cell);
+
+    const float* s = &m_samples[offset + (cell.z * SAMPLES_PER_EDGE + cell.y) * SAMPLES_PER_EDGE + cell.x];
+    const int dy = SAMPLES_PER_EDGE;
+    const int dz = SAMPLES_PER_EDGE * SAMPLES_PER_EDGE;
+    float x00 = glm::mix(s[0],       s[1],           f.x);
+    float x10 = glm::mix(s[dy],      s[dy + 1],      f.x);
+    float x01 = glm::mix(s[dz],      s[dz + 1],      f.x);
+    float x11 = glm::mix(s[dz + dy], s[dz + dy + 1], f.x);
+    float interpolated = glm::mix(glm::mix(x00, x10, f.y), glm::mix(x01, x11, f.y), f.z);
+
+    // The weighted distance from p to the corners is at most half a cell diagonal (at the cell center), so the
+    // interpolated value can be at most that much above the true SDF
+    return interpolated - std::sqrt(3.0f) * m_cellSize / 2.0f;
+}
+
+float SDFVolume::exactThreshold() const {
+    return std::sqrt(3.0f) * m_cellSize;
+}
+
+int SDFVolume::resolution() const {
+    return m_bricksPerAxis * BRICK_CELLS;
+}
+
+float SDFVolume::extent() const {
+    return m_extent;
+}
+
+glm::vec3 SDFVolume::brickCenter(int bx, int by, int bz) const {
+    return (glm::vec3(bx, by, bz) + 0.5f) * float(BRICK_CELLS) * m_cellSize - m_extent;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "shape.h"
+
+/**
+ * A shape's object space SDF baked into a sparse grid of bricks covering its bounding cube.
+ *
+ * Every brick stores the distance at its center. Bricks that the surface can pass through additionally store
+ * (BRICK_CELLS + 1)^3 samples, so lookups near the surface are trilinear instead of a single coarse value.
+ * Lookups return a lower bound on the distance, which is safe to march with but not accurate near the surface:
+ * below exactThreshold() the caller should fall back to the exact SDF.
+ */
+class SDFVolume {
+public:
+    // The number of cells along each edge of a brick
+    static const int BRICK_CELLS = 8;
+
+    /**
+     * @brief bake Evaluates the shape's SDF (at full detail) over its bounding cube.
+     * @param resolution The number of cells along each edge of the cube, rounded up to a whole number of bricks
+     */
+    static std::shared_ptr<SDFVolume> bake(const Shape& shape, int resolution);
+
+    /**
+     * @brief loadOrBake Loads the volume for key from cacheDir, or bakes it and saves it there if it isn't
+     * cached yet (or was baked with different settings). Volumes are also shared between shapes in this process.
+     */
+    static std::shared_ptr<const SDFVolume> loadOrBake(const Shape& shape, const std::string& key,
+                                                       const std::string& cacheDir, int resolution);
+
+    // Returns nullptr if the file is missing or unreadable
+    static std::shared_ptr<SDFVolume> load(const std::string& path);
+    bool save(const std::string& path) const;
+
+    // A lower bound on the object space distance from p to the surface
+    float lowerBound(glm::vec3 p) const;
+
+    // Lower bounds smaller than this are too loose to step by, use the exact SDF instead
+    float exactThreshold() const;
+
+    int resolution() const;
+    float extent() const;
+
+private:
+    // Index of the first sample of each brick, or -1 for bricks that only store their center distance
+    std::vector<int> m_brickOffsets;
+    std::vector<float> m_brickCenterDistances;
+    std::vector<float> m_samples;
+
+    int m_bricksPerAxis = 0;
+    float m_extent = 0; // Half the width of the cube, which is centered on the object space origin
+    float m_cellSize = 0;
+
+    glm::vec3 brickCenter(int bx, int by, int bz) const;
+    float brickLowerBound(int brick, glm::ivec3 brickCoords, glm::vec3 p) const;
+};
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "shadowmap.h"
+#include "intersect.h"
+#include "raytracescene.h"
+
+// Spot lights wider than this (half angle, in radians) would spread a perspective map too thin, so they keep
+// using shadow rays
+const static float MAX_SPOT_MAP_ANGLE = 75.0f * PI / 180.0f;
+// How far past the scene's bounds the rays of a directional light's map start
+const static float DIRECTIONAL_MAP_MARGIN = 1.0f;
+// Depth compares allow this much on top of the slope scaled bias, the same as the offset shadow rays start at
+const static float CONSTANT_DEPTH_BIAS = 0.01f;
+// The steepest slope (as a tangent) the depth bias is scaled for. Steeper surfaces face away from the light.
+const static float MAX_BIAS_SLOPE = 10.0f;
+
+bool ShadowMap::supports(const SceneLightData& light) {
+    return light.type == LightType::LIGHT_DIRECTIONAL
+           || (light.type == LightType::LIGHT_SPOT && light.angle <= MAX_SPOT_MAP_ANGLE);
+}
+
+void ShadowMap::render(const SceneLightData& light, const RayTraceScene& scene, int resolution, bool parallel) {
+    m_resolution = 0;
+    m_depths.clear();
+    if (!supports(light) || resolution <= 0)
+        return;
+
+    m_perspective = light.type == LightType::LIGHT_SPOT;
+    m_w = glm::normalize(glm::vec3(light.dir));
+    glm::vec3 up = std::abs(m_w.y) < 0.99f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+    m_u = glm::normalize(glm::cross(up, m_w));
+    m_v = glm::cross(m_w, m_u);
+
+    if (m_perspective) {
+        m_origin = light.pos;
+        m_extent = std::tan(light.angle);
+        m_texelSize = 2.0f * m_extent / resolution;
+    } else {
+        // Fit the map around the bounding spheres of every bounded shape
+        glm::vec3 boundsMin(std::numeric_limits<float>::infinity());
+        glm::vec3 boundsMax(-std::numeric_limits<float>::infinity());
+        for (const Shape* shape : scene.getShapes()) {
+            float radius = shape->getWorldBoundRadius();
+            if (std::isinf(radius))
+                continue;
+            boundsMin = glm::min(boundsMin, glm::vec3(shape->getWorldBoundCenter()) - radius);
+            boundsMax = glm::max(boundsMax, glm::vec3(shape->getWorldBoundCenter()) + radius);
+        }
+        if (boundsMin.x > boundsMax.x)
+            return;
+
+        glm::vec3 center = (boundsMin + boundsMax) / 2.0f;
+        float radius = 0.0f;
+        for (const Shape* shape : scene.getShapes()) {
+            float shapeRadius = shape->getWorldBoundRadius();
+            if (!std::isinf(shapeRadius))
+                radius = std::max(radius, glm::distance(center, glm::vec3(shape->getWorldBoundCenter())) + shapeRadius);
+        }
+        m_extent = radius;
+        m_origin = center - m_w * (radius + DIRECTIONAL_MAP_MARGIN);
+        m_texelSize = 2.0f * m_extent / resolution;
+    }
+
+    m_resolution = resolution;
+    m_depths.assign(resolution * resolution, std::numeric_limits<float>::infinity());
+
+    #pragma omp parallel for if (parallel)
+    for (int j = 0; j < resolution; j++) {
+        for (int i = 0; i < resolution; i++) {
+            float x = m_extent * (2.0f * (i + 0.5f) / resolution - 1.0f);
+            float y = m_extent * (2.0f * (j + 0.5f) / resolution - 1.0f);
+            Ray ray = m_perspective
+                    ? Ray{glm::vec4(m_origin, 1), glm::vec4(glm::normalize(m_w + x * m_u + y * m_v), 0)}
+                    : Ray{glm::vec4(m_origin + x * m_u + y * m_v, 1), glm::vec4(m_w, 0)};
+            std::optional<Intersect> intersection = intersect(scene, ray);
+            if (intersection.has_value())
+                m_depths[j * resolution + i] = intersection.value().t;
+        }
+    }
+}
+
+bool ShadowMap::empty() const {
+    return m_depths.empty();
+}
+
+bool ShadowMap::project(glm::vec4 point, float& x, float& y, float& depth) const {
+    glm::vec3 offset = glm::vec3(point) - m_origin;
+    float z = glm::dot(offset, m_w);
+    float u = glm::dot(offset, m_u);
+    float v = glm::dot(offset, m_v);
+    if (m_perspective) {
+        if (z <= 0)
+            return false;
+        u /= z;
+        v /= z;
+        depth = glm::length(offset);
+    } else {
+        depth = z;
+    }
+    x = (u / m_extent + 1.0f) / 2.0f * m_resolution - 0.5f;
+    y = (v / m_extent + 1.0f) / 2.0f * m_resolution - 0.5f;
+    return true;
+}
+
+float ShadowMap::visibility(glm::vec4 point, glm::vec4 normal) const {
+    float x, y, depth;
+    if (empty() || !project(point, x, y, depth))
+        return 1.0f;
+
+    // The surface's depth changes by up to a texel times its slope between neighbouring texels, and the filter
+    // reaches one texel past the nearest one
+    glm::vec3 toLight = m_perspective ? glm::normalize(m_origin - glm::vec3(point)) : -m_w;
+    float cosine = std::abs(glm::dot(glm::normalize(glm::vec3(normal)), toLight));
+    float slope = cosine > 0 ? std::min(std::sqrt(1.0f - cosine * cosine) / cosine, MAX_BIAS_SLOPE) : MAX_BIAS_SLOPE;
+    float texelSize = m_perspective ? m_texelSize * depth : m_texelSize;
+    float bias = CONSTANT_DEPTH_BIAS + 1.5f * texelSize * (1.0f + slope);
+
+    int centerX = std::lround(x);
+    int centerY = std::lround(y);
+    int lit = 0;
+    int samples = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            int i = centerX + dx;
+            int j = centerY + dy;
+            if (i < 0 || i >= m_resolution || j < 0 || j >= m_resolution)
+                continue;
+            samples++;
+            lit += m_depths[j * m_resolution + i] + bias >= depth;
+        }
+    }
+    return samples > 0 ? (float)lit / samples : 1.0f;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/scenedata.h"
+
+class RayTraceScene;
+
+/**
+ * A depth map rendered from a directional or spot light, for answering shadow queries with a lookup instead of a
+ * shadow ray. Directional lights get an orthographic map fitted around the scene's bounding spheres, spot lights a
+ * perspective map covering their cone. Lookups compare against the 3x3 texels around the point (percentage closer
+ * filtering), which also softens the map's stair steps.
+ */
+class ShadowMap {
+public:
+    // Whether the light's shadows can come from a map (directional lights, and spot lights with a narrow enough cone)
+    static bool supports(const SceneLightData& light);
+
+    // Traces the map's depths from the light through the scene as it is now, with resolution x resolution texels
+    void render(const SceneLightData& light, const RayTraceScene& scene, int resolution, bool parallel);
+
+    bool empty() const;
+
+    // How much of the light reaches the point on a surface with the given normal, from 0 (in shadow) to 1 (fully
+    // lit). Points the map doesn't cover are lit.
+    float visibility(glm::vec4 point, glm::vec4 normal) const;
+
+private:
+    int m_resolution = 0;
+    bool m_perspective = false;
+    glm::vec3 m_origin;   // The center of the plane a directional light's rays start on, or the spot light's position
+    glm::vec3 m_u, m_v, m_w; // The map's axes, w pointing away from the light
+    float m_extent;       // Half the map's width in world units, or the tangent of half its field of view
+    float m_texelSize;    // Width of a texel in world units, or per unit of distance from a spot light
+    std::vector<float> m_depths; // Distance to the first hit along each texel's ray (infinity for none)
+
+    // Maps the point to texel coordinates, and its depth along the light's ray. False if it's behind a spot light.
+    bool project(glm::vec4 point, float& x, float& y, float& depth) const;
+};
@@ -4,9 +4,12 @@
 #include "glm/fwd.hpp"
 #include "raytracer/raytracer.h"
 #include "utils/scenedata.h"
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <optional>
 #include "utils/bezierfuncs.h"
+#include "utils/scenearena.h"
 
 class Shape; // Forward ref
 
@@ -15,6 +18,14 @@ struct PPShape {
     bool isPlural = false;
     std::vector<float> blends;
     std::vector<const Shape*> shapes;
+    // The instance the shape was hit through, if any. Its shapes are then placed in the instance's prototype
+    // rather than in the world.
+    const Shape* instance = nullptr;
+    // The SDF group the shape was hit through, if any (and the hit isn't a blend). The shape is then one of its
+    // members, which the rest of the group can carve away.
+    const Shape* group = nullptr;
+    // Whether the hit was found by ray marching. Its shapes may then be members of a marched group or instance.
+    bool marched = false;
 };
 
 struct Intersect{
@@ -34,33 +45,108 @@ public:
     glm::mat4 m_ctm;
     glm::mat4 m_ctm_inverse;
     glm::mat3 m_worldNormal;
-    ScenePrimitive m_primative;
-    float m_minScale;
+    const SceneMaterial* m_material; // Owned by the scene's arena, and shared by shapes with equal materials
+    const AnimationCurve* m_curve;   // nullptr for shapes that don't move
+    float m_minScale; // The least the CTM can shrink a distance (its smallest singular value)
+    float m_maxScale; // The most the CTM can stretch a distance (its largest singular value)
     // destructors must always be virtual if you decide to use virtual functions
-    Shape(ScenePrimitive primative, glm::mat4 ctm, float minScale): m_primative{primative} {
+    Shape(ShapeData data, glm::mat4 ctm): m_material{data.material}, m_curve{data.curve} {
         m_origCtm = ctm;
         m_ctm = ctm;
         m_ctm_inverse = glm::inverse(ctm);
         glm::mat3 m3 = ctm;
         m_worldNormal = glm::inverse(glm::transpose(m3));
-        m_minScale = minScale;
+        m_minScale = minStretch(m3);
+        m_maxScale = maxStretch(m3);
     }
     virtual ~Shape() = default;
     virtual glm::vec3 getNormal(glm::vec4 position) const = 0;
     virtual std::optional<Intersect> intersect(Ray ray) const = 0;
     virtual float shapeSDF(glm::vec4 position) const = 0;
+    // Same as shapeSDF, but may leave out surface detail smaller than footprint (in object space units).
+    virtual float shapeSDFLod(glm::vec4 position, float /*footprint*/) const {
+        return shapeSDF(position);
+    }
+    // Evaluates shapeSDFLod at count object space positions at once. Shapes with expensive SDFs override this
+    // with a vectorized version.
+    virtual void shapeSDFBatch(const glm::vec4* positions, float* out, int count, float footprint) const {
+        for (int i = 0; i < count; i++) {
+            out[i] = shapeSDFLod(positions[i], footprint);
+        }
+    }
     virtual TextureMap getTextureMap(glm::vec4 position) const = 0;
+    // Radius of a sphere centered at the object space origin that contains the whole shape
+    // (infinity for shapes that are unbounded).
+    virtual float boundingRadius() const = 0;
+    // Whether the shape can only be intersected by ray marching its SDF (no closed form intersect).
+    virtual bool requiresMarching() const { return false; }
+    // The shape whose material a marched hit at worldPosition should be shaded with (groups return a member).
+    virtual const Shape* surfaceShape(glm::vec4 /*worldPosition*/) const { return this; }
+    // Whether the shape is an instance of a shared prototype (see InstanceShape)
+    virtual bool isInstance() const { return false; }
+    // How much faster than the distance to the surface the object space SDF can change (1 for exact SDFs).
+    virtual float lipschitzBound() const { return 1.0f; }
+
+    // Converts object space SDF values into world space distances that are safe to step by in any direction
+    float stepScale() const {
+        return m_minScale / lipschitzBound();
+    }
+
+    // Same as stepScale, but only safe to step along the world space direction d (in units of d). Much larger than
+    // stepScale for rays along the directions a non-uniform scale stretches.
+    float stepScale(glm::vec4 d) const {
+        return 1.0f / (glm::length(glm::vec3(m_ctm_inverse * d)) * lipschitzBound());
+    }
+
+    glm::vec4 getWorldBoundCenter() const {
+        return m_ctm[3];
+    }
+
+    float getWorldBoundRadius() const {
+        return boundingRadius() * m_maxScale;
+    }
+
+    // The largest and smallest singular values of the matrix: how much it can stretch or shrink a distance.
+    static float maxStretch(const glm::mat3& m) {
+        return std::sqrt(squaredSingularValues(m)[0]);
+    }
+
+    static float minStretch(const glm::mat3& m) {
+        return std::sqrt(squaredSingularValues(m)[2]);
+    }
+
+    // The eigenvalues of m^T m, largest first, in closed form (Smith 1961: "Eigenvalues of a symmetric 3x3 matrix").
+    static glm::vec3 squaredSingularValues(const glm::mat3& m) {
+        glm::mat3 a = glm::transpose(m) * m;
+        float offDiagonal = a[0][1] * a[0][1] + a[0][2] * a[0][2] + a[1][2] * a[1][2];
+        if (offDiagonal == 0) {
+            glm::vec3 diagonal{a[0][0], a[1][1], a[2][2]};
+            std::sort(&diagonal[0], &diagonal[0] + 3, std::greater<float>());
+            return diagonal;
+        }
+
+        float q = (a[0][0] + a[1][1] + a[2][2]) / 3.0f;
+        float p2 = (a[0][0] - q) * (a[0][0] - q) + (a[1][1] - q) * (a[1][1] - q) + (a[2][2] - q) * (a[2][2] - q)
+                   + 2.0f * offDiagonal;
+        float p = std::sqrt(p2 / 6.0f);
+        glm::mat3 b = (a - q * glm::mat3(1)) / p;
+        float phi = std::acos(std::clamp(glm::determinant(b) / 2.0f, -1.0f, 1.0f)) / 3.0f;
+
+        float largest = q + 2.0f * p * std::cos(phi);
+        float smallest = q + 2.0f * p * std::cos(phi + 2.0f * 3.14159265f / 3.0f);
+        return glm::max(glm::vec3(largest, 3.0f * q - largest - smallest, smallest), 0.0f);
+    }
 
     void updatePosition(float time)  { // for translating the shape relative to its original world space position over time
-        if (!m_primative.useBezierCurves) {
+        if (m_curve == nullptr) {
             return;
         }
         glm::mat4 translationMatrix(1.);
         // get the relative position along this shape's bezier curve
         double intpart;
-        float bezierTime = modf((double)time * m_primative.movementSpeed, &intpart);
+        float bezierTime = modf((double)time * m_curve->speed, &intpart);
         std::cout << bezierTime << std::endl;
-        translationMatrix[3] = glm::vec4(bezier(m_primative.controlPoints, bezierTime), 1.f);
+        translationMatrix[3] = glm::vec4(bezier(m_curve->controlPoints, m_curve->numControlPoints, bezierTime), 1.f);
         // left-mult orig CTM by relative translation mat4 depending on pos along bezier curve at curr time
         m_ctm = translationMatrix * m_origCtm;
         // update view and normal transformation matrices
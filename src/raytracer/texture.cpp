@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include "texture.h"
+#include "qfile.h"
+#include "qimage.h"
+
+const static char FILE_MAGIC[4] = {'R', 'T', 'T', 'X'};
+const static int FILE_VERSION = 2;
+// The blocks start a page into the file, so every block is a page of its own
+const static int FILE_DATA_OFFSET = Texture::BLOCK_TEXELS * sizeof(RGBA);
+
+struct TextureFileHeader {
+    char magic[4];
+    int version;
+    int width;
+    int height;
+    int numBlocks;
+    std::uint64_t sourceStamp;
+};
+
+// Distinguishes the blocks of different textures in the tile cache
+static std::atomic<std::uint32_t> nextTextureId{0};
+
+Texture::Texture():
+    m_id(nextTextureId++)
+{}
+
+Texture::Texture(int width, int height, const std::vector<RGBA>& data):
+    m_id(nextTextureId++)
+{
+    layout(width, height);
+    m_texels.resize(m_numBlocks * BLOCK_TEXELS);
+
+    const Level& full = m_levels[0];
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            m_texels[full.index(x, y)] = data[y * width + x];
+        }
+    }
+
+    // Each texel of a level averages the (up to) 2x2 texels above it
+    for (int i = 1; i < m_levels.size(); i++) {
+        const Level& above = m_levels[i - 1];
+        const Level& level = m_levels[i];
+        for (int y = 0; y < level.height; y++) {
+            for (int x = 0; x < level.width; x++) {
+                int x0 = std::min(2 * x, above.width - 1), x1 = std::min(2 * x + 1, above.width - 1);
+                int y0 = std::min(2 * y, above.height - 1), y1 = std::min(2 * y + 1, above.height - 1);
+                const RGBA& a = m_texels[above.index(x0, y0)];
+                const RGBA& b = m_texels[above.index(x1, y0)];
+                const RGBA& c = m_texels[above.index(x0, y1)];
+                const RGBA& d = m_texels[above.index(x1, y1)];
+                m_texels[level.index(x, y)] = RGBA{
+                    (std::uint8_t)((a.r + b.r + c.r + d.r + 2) / 4),
+                    (std::uint8_t)((a.g + b.g + c.g + d.g + 2) / 4),
+                    (std::uint8_t)((a.b + b.b + c.b + d.b + 2) / 4),
+                    (std::uint8_t)((a.a + b.a + c.a + d.a + 2) / 4),
+                };
+            }
+        }
+    }
+}
+
+Texture::~Texture() = default;
+
+void Texture::layout(int width, int height) {
+    m_levels.clear();
+    m_numBlocks = 0;
+    while (true) {
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.blocksPerRow = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        level.firstBlock = m_numBlocks;
+        m_levels.push_back(level);
+        m_numBlocks += level.blocksPerRow * ((height + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (width == 1 && height == 1)
+            break;
+        width = std::max(1, (width + 1) / 2);
+        height = std::max(1, (height + 1) / 2);
+    }
+}
+
+std::unique_ptr<Texture> Texture::open(const std::string& path, std::uint64_t sourceStamp, TextureTileCache* tiles) {
+    auto file = std::make_unique<QFile>(QString::fromStdString(path));
+    if (!file->open(QIODevice::ReadOnly) || file->size() < FILE_DATA_OFFSET)
+        return nullptr;
+
+    const uchar* mapped = file->map(0, file->size());
+    if (mapped == nullptr)
+        return nullptr;
+
+    TextureFileHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0
+        || header.version != FILE_VERSION
+        || header.sourceStamp != sourceStamp
+        || header.width <= 0
+        || header.height <= 0)
+        return nullptr;
+
+    std::unique_ptr<Texture> texture(new Texture());
+    texture->layout(header.width, header.height);
+    if (header.numBlocks != texture->m_numBlocks
+        || file->size() < FILE_DATA_OFFSET + (qint64)texture->m_numBlocks * BLOCK_TEXELS * sizeof(RGBA))
+        return nullptr;
+
+    texture->m_mappedTexels = reinterpret_cast<const RGBA*>(mapped + FILE_DATA_OFFSET);
+    texture->m_tiles = tiles;
+    texture->m_file = std::move(file);
+    return texture;
+}
+
+bool Texture::save(const std::string& path, std::uint64_t sourceStamp) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file || m_texels.empty())
+        return false;
+
+    TextureFileHeader header{};
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.width = width();
+    header.height = height();
+    header.numBlocks = m_numBlocks;
+    header.sourceStamp = sourceStamp;
+
+    std::vector<char> headerPage(FILE_DATA_OFFSET, 0);
+    std::memcpy(headerPage.data(), &header, sizeof(header));
+    file.write(headerPage.data(), headerPage.size());
+    file.write(reinterpret_cast<const char*>(m_texels.data()), m_texels.size() * sizeof(RGBA));
+    return (bool)file;
+}
+
+int Texture::width() const {
+    return m_levels[0].width;
+}
+
+int Texture::height() const {
+    return m_levels[0].height;
+}
+
+int Texture::levels() const {
+    return m_levels.size();
+}
+
+static glm::vec4 toColor(const RGBA& value) {
+    return glm::vec4(value.r, value.g, value.b, 255) / 255.0f;
+}
+
+RGBA Texture::fetch(int index) const {
+    if (m_tiles == nullptr)
+        return m_texels[index];
+    return m_tiles->texel(*this, index);
+}
+
+void Texture::fetchQuad(int first, RGBA quad[4]) const {
+    if (m_tiles != nullptr) {
+        m_tiles->quad(*this, first, quad);
+        return;
+    }
+    quad[0] = m_texels[first];
+    quad[1] = m_texels[first + 1];
+    quad[2] = m_texels[first + BLOCK_SIZE];
+    quad[3] = m_texels[first + BLOCK_SIZE + 1];
+}
+
+glm::vec4 Texture::texel(const Level& level, int x, int y) const {
+    // Wrap around for repeated textures
+    if (x < 0 || x >= level.width) {
+        x %= level.width;
+        if (x < 0)
+            x += level.width;
+    }
+    if (y < 0 || y >= level.height) {
+        y %= level.height;
+        if (y < 0)
+            y += level.height;
+    }
+    return toColor(fetch(level.index(x, y)));
+}
+
+glm::vec4 Texture::sampleNearest(float s, float t) const {
+    const Level& level = m_levels[0];
+    return texel(level, (int)std::floor(s * level.width), (int)std::floor(t * level.height));
+}
+
+glm::vec4 Texture::sampleBilinear(const Level& level, float s, float t) const {
+    float x = s * level.width - 0.5f;
+    float y = t * level.height - 0.5f;
+    float x0 = std::floor(x);
+    float y0 = std::floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+    int i = x0, j = y0;
+
+    // Fast path: when the 2x2 texels are in one block (and don't wrap), they're at fixed offsets from the first, and
+    // a streamed texture finds the block once
+    const int lastInBlock = BLOCK_SIZE - 1;
+    if (i >= 0 && j >= 0 && i + 1 < level.width && j + 1 < level.height
+        && (i & lastInBlock) != lastInBlock && (j & lastInBlock) != lastInBlock) {
+        RGBA quad[4];
+        fetchQuad(level.index(i, j), quad);
+        glm::vec4 top = glm::mix(toColor(quad[0]), toColor(quad[1]), fx);
+        glm::vec4 bottom = glm::mix(toColor(quad[2]), toColor(quad[3]), fx);
+        return glm::mix(top, bottom, fy);
+    }
+
+    glm::vec4 top = glm::mix(texel(level, i, j), texel(level, i + 1, j), fx);
+    glm::vec4 bottom = glm::mix(texel(level, i, j + 1), texel(level, i + 1, j + 1), fx);
+    return glm::mix(top, bottom, fy);
+}
+
+glm::vec4 Texture::sampleTrilinear(float s, float t, float lod) const {
+    lod = std::clamp(lod, 0.0f, (float)(m_levels.size() - 1));
+    int level = std::min((int)lod, (int)m_levels.size() - 2);
+    if (level < 0)
+        return sampleBilinear(m_levels[0], s, t);
+    return glm::mix(sampleBilinear(m_levels[level], s, t), sampleBilinear(m_levels[level + 1], s, t), lod - level);
+}
+
+// Distinguishes tile caches in the threads' last blocks
+static std::atomic<std::uint64_t> nextTileCacheId{1};
+
+const std::size_t TextureTileCache::MIN_BUDGET_BYTES = NUM_SHARDS * Texture::BLOCK_TEXELS * sizeof(RGBA);
+
+thread_local TextureTileCache::LastBlock TextureTileCache::t_lastBlock;
+
+TextureTileCache::TextureTileCache(std::size_t budgetBytes):
+    m_id(nextTileCacheId++),
+    m_blocksPerShard(std::max(budgetBytes, MIN_BUDGET_BYTES) / (Texture::BLOCK_TEXELS * sizeof(RGBA)) / NUM_SHARDS)
+{}
+
+TextureTileCache::Shard& TextureTileCache::shardFor(std::uint64_t key) {
+    // Neighbouring blocks go to different shards
+    return m_shards[(key ^ (key >> 32)) % NUM_SHARDS];
+}
+
+const TextureTileCache::Slot* TextureTileCache::lastBlock(std::uint64_t key) {
+    LastBlock& last = t_lastBlock;
+    if (last.cacheId != m_id || last.key != key || last.slot->version.load(std::memory_order_acquire) != last.version)
+        return nullptr;
+    return last.slot;
+}
+
+bool TextureTileCache::stillValid() {
+    // The slot may have been given to another block while its texels were read, in which case they're discarded
+    LastBlock& last = t_lastBlock;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (last.slot->version.load(std::memory_order_relaxed) != last.version)
+        return false;
+    last.hits++;
+    return true;
+}
+
+const TextureTileCache::Slot& TextureTileCache::block(Shard& shard, std::uint64_t key, const Texture& texture,
+                                                      int blockIndex) {
+    LastBlock& last = t_lastBlock;
+    if (last.cacheId == m_id)
+        shard.stats.hits += last.hits;
+    last.hits = 0;
+
+    Slot* slot;
+    auto entry = shard.entries.find(key);
+    if (entry != shard.entries.end()) {
+        shard.stats.hits++;
+        shard.lru.splice(shard.lru.begin(), shard.lru, entry->second.lru);
+        slot = shard.slots[entry->second.slot].get();
+    } else {
+        shard.stats.misses++;
+        int index;
+        if (shard.slots.size() < m_blocksPerShard) {
+            index = shard.slots.size();
+            shard.slots.push_back(std::make_unique<Slot>());
+            slot = shard.slots.back().get();
+            std::memcpy(slot->texels, texture.m_mappedTexels + (std::size_t)blockIndex * Texture::BLOCK_TEXELS,
+                        sizeof(slot->texels));
+        } else {
+            auto evicted = shard.entries.find(shard.lru.back());
+            index = evicted->second.slot;
+            shard.entries.erase(evicted);
+            shard.lru.pop_back();
+            shard.stats.evictions++;
+
+            // Other threads may still be reading the evicted block through their last block, so the version is made
+            // odd while the slot is overwritten, and moved on after
+            slot = shard.slots[index].get();
+            std::uint32_t version = slot->version.load(std::memory_order_relaxed);
+            slot->version.store(version + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(slot->texels, texture.m_mappedTexels + (std::size_t)blockIndex * Texture::BLOCK_TEXELS,
+                        sizeof(slot->texels));
+            slot->version.store(version + 2, std::memory_order_release);
+        }
+        shard.lru.push_front(key);
+        shard.entries.emplace(key, Entry{shard.lru.begin(), index});
+    }
+
+    last = LastBlock{m_id, key, slot, slot->version.load(std::memory_order_relaxed), 0};
+    return *slot;
+}
+
+RGBA TextureTileCache::texel(const Texture& texture, int index) {
+    int blockIndex = index / Texture::BLOCK_TEXELS;
+    std::uint64_t key = ((std::uint64_t)texture.m_id << 32) | (std::uint32_t)blockIndex;
+    if (const Slot* slot = lastBlock(key)) {
+        RGBA texel = slot->texels[index % Texture::BLOCK_TEXELS];
+        if (stillValid())
+            return texel;
+    }
+
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return block(shard, key, texture, blockIndex).texels[index % Texture::BLOCK_TEXELS];
+}
+
+void TextureTileCache::quad(const Texture& texture, int first, RGBA texels[4]) {
+    int blockIndex = first / Texture::BLOCK_TEXELS;
+    std::uint64_t key = ((std::uint64_t)texture.m_id << 32) | (std::uint32_t)blockIndex;
+    auto copy = [&](const Slot& slot) {
+        const RGBA* data = slot.texels + first % Texture::BLOCK_TEXELS;
+        texels[0] = data[0];
+        texels[1] = data[1];
+        texels[2] = data[Texture::BLOCK_SIZE];
+        texels[3] = data[Texture::BLOCK_SIZE + 1];
+    };
+    if (const Slot* slot = lastBlock(key)) {
+        copy(*slot);
+        if (stillValid())
+            return;
+    }
+
+    Shard& shard = shardFor(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    copy(block(shard, key, texture, blockIndex));
+}
+
+TextureTileStats TextureTileCache::stats() {
+    TextureTileStats total;
+    for (Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total.hits += shard.stats.hits;
+        total.misses += shard.stats.misses;
+        total.evictions += shard.stats.evictions;
+    }
+    return total;
+}
+
+void TextureTileCache::resetStats() {
+    for (Shard& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.stats = TextureTileStats{};
+    }
+}
+
+TextureCache::TextureCache(std::size_t budgetBytes, const std::string& cacheDir):
+    m_tiles(budgetBytes > 0 ? std::make_unique<TextureTileCache>(budgetBytes) : nullptr),
+    m_cacheDir(cacheDir)
+{}
+
+bool TextureCache::streaming() const {
+    return m_tiles != nullptr;
+}
+
+TextureTileStats TextureCache::tileStats() {
+    return m_tiles ? m_tiles->stats() : TextureTileStats{};
+}
+
+void TextureCache::resetTileStats() {
+    if (m_tiles)
+        m_tiles->resetStats();
+}
+
+const Texture* TextureCache::get(const SceneFileMap& fileMap) {
+    {
+        std::shared_lock lock(m_mutex);
+        auto texture = m_textures.find(fileMap.filename);
+        if (texture != m_textures.end())
+            return texture->second.get();
+    }
+
+    std::unique_lock lock(m_mutex);
+    // Another thread may have loaded it while we waited for the lock
+    auto texture = m_textures.find(fileMap.filename);
+    if (texture == m_textures.end())
+        texture = m_textures.emplace(fileMap.filename, load(fileMap.filename)).first;
+    return texture->second.get();
+}
+
+std::unique_ptr<Texture> TextureCache::load(const std::string& path) {
+    if (!m_tiles)
+        return decode(path);
+
+    // The tile file is named after the image's path, and remembers the size and time of the image it was made from
+    std::error_code error;
+    std::filesystem::path source = std::filesystem::absolute(path, error);
+    auto modified = std::filesystem::last_write_time(source, error);
+    std::uint64_t stamp = error ? 0 : (std::uint64_t)modified.time_since_epoch().count();
+    stamp = stamp * 31 + std::filesystem::file_size(source, error);
+
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>{}(source.string()) << ".tex";
+    const std::string tilePath = (std::filesystem::path(m_cacheDir) / name.str()).string();
+
+    std::unique_ptr<Texture> texture = Texture::open(tilePath, stamp, m_tiles.get());
+    if (texture)
+        return texture;
+
+    std::unique_ptr<Texture> decoded = decode(path);
+    if (!decoded)
+        return nullptr;
+
+    std::cout << "Preprocessing texture \"" << path << "\" into tiles..." << std::endl;
+    std::filesystem::create_directories(m_cacheDir, error);
+    if (decoded->save(tilePath, stamp))
+        texture = Texture::open(tilePath, stamp, m_tiles.get());
+    if (!texture) {
+        std::cerr << "Warning: could not stream texture from \"" << tilePath << "\", keeping it in memory" << std::endl;
+        return decoded;
+    }
+    return texture;
+}
+
+std::unique_ptr<Texture> TextureCache::decode(const std::string& path) {
+    QImage image;
+    if (!image.load(QString::fromStdString(path))) {
+        std::cout << "Failed to load in image " << path << std::endl;
+        return nullptr;
+    }
+    // RGBX8888 is laid out like RGBA, so rows can be copied as they are
+    image = image.convertToFormat(QImage::Format_RGBX8888);
+    int width = image.width();
+    int height = image.height();
+
+    std::vector<RGBA> data(width * height);
+    for (int y = 0; y < height; y++) {
+        std::memcpy(&data[y * width], image.constScanLine(y), width * sizeof(RGBA));
+    }
+    return std::make_unique<Texture>(width, height, data);
+}
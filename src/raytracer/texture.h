@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "utils/rgba.h"
+#include "utils/scenedata.h"
+
+class QFile;
+class TextureTileCache;
+
+/**
+ * An image with its mip pyramid: every level halves the one above it (rounding up), down to a single texel.
+ *
+ * Lookups take texture coordinates in images, so (s, t) = (1, 1) is one full image along each axis, and the
+ * texture repeats outside [0, 1). t runs down the image, like its rows.
+ *
+ * Texels are stored in 32x32 texel blocks (4 KB, a page), row by row within each block, every level starting on a
+ * new block. A texture is either kept in memory whole, or streamed: its blocks are mapped from a tile file written
+ * by save(), and only read in through a TextureTileCache when lookups need them. (Smaller 8x8 tiles within the
+ * blocks made no consistent difference to lookups in benchmarks/texturebench.cpp, so the blocks keep rows.)
+ */
+class Texture {
+public:
+    // data holds the full resolution image row by row
+    Texture(int width, int height, const std::vector<RGBA>& data);
+    ~Texture();
+
+    // Opens a tile file written by save() for streaming through the tile cache. nullptr if the file can't be mapped,
+    // or wasn't saved from the same version of the source image (sourceStamp).
+    static std::unique_ptr<Texture> open(const std::string& path, std::uint64_t sourceStamp, TextureTileCache* tiles);
+    // Writes the pyramid of a texture kept in memory to a tile file
+    bool save(const std::string& path, std::uint64_t sourceStamp) const;
+
+    int width() const;
+    int height() const;
+    int levels() const;
+
+    // The full resolution texel that (s, t) falls in
+    glm::vec4 sampleNearest(float s, float t) const;
+
+    // Trilinear lookup: bilinear on the two levels around lod (the log2 of how many full resolution texels one
+    // sample covers), blended between them. Negative lods magnify the full resolution image.
+    glm::vec4 sampleTrilinear(float s, float t, float lod) const;
+
+    static const int BLOCK_SHIFT = 5;
+    static const int BLOCK_SIZE = 1 << BLOCK_SHIFT;
+    static const int BLOCK_TEXELS = BLOCK_SIZE * BLOCK_SIZE;
+
+private:
+    friend class TextureTileCache;
+
+    struct Level {
+        int width;
+        int height;
+        int blocksPerRow;
+        int firstBlock;
+
+        // Where texel (x, y) (which must be inside the level) is stored among the texture's texels
+        int index(int x, int y) const {
+            int block = firstBlock + (y >> BLOCK_SHIFT) * blocksPerRow + (x >> BLOCK_SHIFT);
+            return (block << (2 * BLOCK_SHIFT)) + ((y & (BLOCK_SIZE - 1)) << BLOCK_SHIFT) + (x & (BLOCK_SIZE - 1));
+        }
+    };
+
+    std::vector<Level> m_levels;
+    int m_numBlocks = 0;
+    // Every block, for a texture kept in memory
+    std::vector<RGBA> m_texels;
+    // For a streamed texture: the mapped tile file, and the cache its blocks are read through
+    std::unique_ptr<QFile> m_file;
+    const RGBA* m_mappedTexels = nullptr;
+    TextureTileCache* m_tiles = nullptr;
+    std::uint32_t m_id;
+
+    Texture();
+    // Lays out the levels of a width x height pyramid, in blocks
+    void layout(int width, int height);
+
+    RGBA fetch(int index) const;
+    // The 2x2 texels from first, which mustn't be in the last row or column of its block
+    void fetchQuad(int first, RGBA quad[4]) const;
+    glm::vec4 texel(const Level& level, int x, int y) const;
+    glm::vec4 sampleBilinear(const Level& level, float s, float t) const;
+};
+
+struct TextureTileStats {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+};
+
+/**
+ * The blocks of streamed textures that are in memory, up to a budget, evicting the least recently used block to
+ * make room for a new one. Blocks are read from the textures' mapped tile files on a miss, so only the mapped pages
+ * lookups actually touch are ever read from disk (and the OS can drop them again, since they're clean).
+ *
+ * The cache is split into shards by block, each with its own lock, LRU list and share of the budget, so rendering
+ * threads rarely wait on each other. Texels are copied out under the lock, as the block may be evicted right after.
+ *
+ * Each thread also remembers the last block it looked up, and reads it again without the lock as long as it hasn't
+ * been evicted since (every slot has a version, bumped around reading a new block into it). Coherent lookups mostly
+ * stay in one block, so they rarely take a lock. Those reads don't move the block up its LRU list, and their hits
+ * are added to the stats the next time the thread takes a lock.
+ */
+class TextureTileCache {
+public:
+    // Every shard holds at least one block, so smaller budgets are rounded up to this
+    static const std::size_t MIN_BUDGET_BYTES;
+
+    explicit TextureTileCache(std::size_t budgetBytes);
+
+    // The texel at index among the texture's texels
+    RGBA texel(const Texture& texture, int index);
+    // The 2x2 texels from first (which mustn't be in the last row or column of its block): first, first + 1, and the
+    // two below them
+    void quad(const Texture& texture, int first, RGBA texels[4]);
+
+    TextureTileStats stats();
+    void resetStats();
+
+private:
+    static const int NUM_SHARDS = 16;
+
+    struct Entry {
+        std::list<std::uint64_t>::iterator lru;
+        int slot;
+    };
+
+    struct Slot {
+        RGBA texels[Texture::BLOCK_TEXELS];
+        // Odd while a block is being read into the slot
+        std::atomic<std::uint32_t> version{0};
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::uint64_t, Entry> entries;
+        std::list<std::uint64_t> lru; // Most recently used first
+        std::vector<std::unique_ptr<Slot>> slots;
+        TextureTileStats stats;
+    };
+
+    // The block a thread looked up last, and the slot's version then
+    struct LastBlock {
+        std::uint64_t cacheId = 0;
+        std::uint64_t key = 0;
+        const Slot* slot = nullptr;
+        std::uint32_t version = 0;
+        std::uint64_t hits = 0; // Not yet added to a shard's stats
+    };
+    static thread_local LastBlock t_lastBlock;
+
+    std::uint64_t m_id;
+    std::size_t m_blocksPerShard;
+    Shard m_shards[NUM_SHARDS];
+
+    // The thread's last block, if it's the keyed one and still in its slot. Reads through it must be checked with
+    // stillValid() afterwards.
+    const Slot* lastBlock(std::uint64_t key);
+    bool stillValid();
+    // The block's slot, reading it in if needed, and makes it the thread's last block. The shard's lock must be held.
+    const Slot& block(Shard& shard, std::uint64_t key, const Texture& texture, int blockIndex);
+    Shard& shardFor(std::uint64_t key);
+};
+
+/**
+ * The textures of a render, loaded once per image file. Lookups can come from any rendering thread: loaded
+ * textures are found under a shared lock, and only loading a new one takes the lock exclusively.
+ *
+ * With a memory budget, textures are streamed instead of kept in memory: the first time an image is used, its
+ * pyramid is preprocessed into a tile file in the cache directory (kept for later renders, until the image changes),
+ * and lookups read its blocks through a TextureTileCache holding at most the budget.
+ */
+class TextureCache {
+public:
+    // A budget of 0 keeps every texture in memory whole
+    TextureCache(std::size_t budgetBytes = 0, const std::string& cacheDir = "");
+
+    // The texture for the file map's image, loading it if needed. nullptr if the image can't be loaded.
+    const Texture* get(const SceneFileMap& fileMap);
+
+    bool streaming() const;
+    // Lookups that hit and missed the tile cache since the last reset, when streaming
+    TextureTileStats tileStats();
+    void resetTileStats();
+
+private:
+    std::unique_ptr<TextureTileCache> m_tiles;
+    std::string m_cacheDir;
+    std::shared_mutex m_mutex;
+    // Images that failed to load map to nullptr, so they're only tried once
+    std::map<std::string, std::unique_ptr<Texture>> m_textures;
+
+    std::unique_ptr<Texture> load(const std::string& path);
+    static std::unique_ptr<Texture> decode(const std::string& path);
+};
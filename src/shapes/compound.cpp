@@ -0,0 +1,143 @@
+#include <stdexcept>
+#include "compound.h"
+#include "utils/sceneparser.h"
+
+// The material of the first primitive under node, or nullptr if there are none
+static const SceneMaterial* firstMaterial(const SceneNode* node) {
+    if (!node->primitives.empty())
+        return &node->primitives[0]->material;
+    for (const SceneNode* child : node->children) {
+        if (const SceneMaterial* material = firstMaterial(child))
+            return material;
+    }
+    return nullptr;
+}
+
+// The group's own material is never shaded (hits resolve to a member), but Shape needs one
+static const SceneMaterial& groupMaterial(const SceneNode* node) {
+    const SceneMaterial* material = firstMaterial(node);
+    if (material == nullptr)
+        throw std::invalid_argument("SDF group has no primitives");
+    return *material;
+}
+
+CompoundShape::CompoundShape(const SceneNode* node, glm::mat4 ctm, SceneArena& arena):
+    Shape(ShapeData{arena.material(groupMaterial(node))}, ctm) {
+    m_tape = SDFTape::compile(buildGroup(node, glm::mat4(1), arena));
+}
+
+/**
+ * Creates the members under node and returns the graph combining them. localCtm takes node's space to the
+ * group's object space.
+ */
+SDFNode CompoundShape::buildGroup(const SceneNode* node, glm::mat4 localCtm, SceneArena& arena) {
+    SDFNode group;
+    group.type = SDFNodeType::SDF_COMBINE;
+    if (node->operation != nullptr) {
+        group.operation = node->operation->type;
+        group.k = node->operation->k;
+    }
+
+    float localStretch = maxStretch(glm::mat3(localCtm));
+    for (ScenePrimitive* primitive : node->primitives) {
+        Shape* member = makeShape(arena, *primitive, m_ctm * localCtm);
+        m_members.push_back(member);
+
+        SDFNode leaf;
+        leaf.type = SDFNodeType::SDF_LEAF;
+        leaf.leaf = member;
+        group.children.push_back(leaf);
+
+        float reach = glm::length(glm::vec3(localCtm[3])) + member->boundingRadius() * localStretch;
+        m_boundingRadius = std::max(m_boundingRadius, reach);
+    }
+
+    for (const SceneNode* child : node->children) {
+        glm::mat4 childMatrix(1);
+        for (const SceneTransformation* transformation : child->transformations) {
+            childMatrix *= transformationToMatrix(*transformation);
+        }
+
+        SDFNode childGroup = buildGroup(child, localCtm * childMatrix, arena);
+        if (childGroup.type == SDFNodeType::SDF_COMBINE && childGroup.children.empty())
+            continue;
+
+        SDFNode transform;
+        transform.type = SDFNodeType::SDF_TRANSFORM;
+        transform.inverse = glm::inverse(childMatrix);
+        transform.children.push_back(std::move(childGroup));
+        group.children.push_back(std::move(transform));
+    }
+
+    if (group.children.empty() || node->operation == nullptr)
+        return group;
+
+    // Blending can pull the surface out past the members, by less than the blend distance
+    if (group.operation == SDFOperationType::SDF_SMOOTH_UNION)
+        m_boundingRadius += group.k * localStretch;
+
+    if (node->operation->repeat == glm::vec3(0))
+        return group;
+
+    m_boundingRadius = std::numeric_limits<float>::infinity();
+    SDFNode repeat;
+    repeat.type = SDFNodeType::SDF_REPEAT;
+    repeat.period = node->operation->repeat;
+    repeat.children.push_back(std::move(group));
+    return repeat;
+}
+
+std::optional<Intersect> CompoundShape::intersect(Ray ray) const {
+    std::optional<Intersect> intersection = std::nullopt;
+    glm::vec4 worldP = m_ctm * ray.p;
+    glm::vec4 worldD = m_ctm * ray.d;
+
+    for (const Shape* member : m_members) {
+        if (member->requiresMarching())
+            continue;
+        Ray memberRay{member->m_ctm_inverse * worldP, member->m_ctm_inverse * worldD};
+        std::optional<Intersect> memberIntersection = member->intersect(memberRay);
+        if (memberIntersection.has_value())
+            replaceIntercept(intersection, memberIntersection.value());
+    }
+
+    if (intersection.has_value())
+        intersection.value().shape.group = this;
+    return intersection;
+}
+
+glm::vec3 CompoundShape::getNormal(glm::vec4 position) const {
+    const float smallStep = 0.001;
+    glm::vec3 objectNormal{
+        shapeSDF(position + glm::vec4(smallStep, 0, 0, 0)) - shapeSDF(position - glm::vec4(smallStep, 0, 0, 0)),
+        shapeSDF(position + glm::vec4(0, smallStep, 0, 0)) - shapeSDF(position - glm::vec4(0, smallStep, 0, 0)),
+        shapeSDF(position + glm::vec4(0, 0, smallStep, 0)) - shapeSDF(position - glm::vec4(0, 0, smallStep, 0))
+    };
+    return objectToWorldNormal(objectNormal, this);
+}
+
+float CompoundShape::shapeSDF(glm::vec4 position) const {
+    return m_tape.evaluate(position, 0.0f);
+}
+
+float CompoundShape::shapeSDFLod(glm::vec4 position, float footprint) const {
+    return m_tape.evaluate(position, footprint);
+}
+
+TextureMap CompoundShape::getTextureMap(glm::vec4 position) const {
+    return surfaceShape(position)->getTextureMap(position);
+}
+
+float CompoundShape::boundingRadius() const {
+    return m_boundingRadius;
+}
+
+bool CompoundShape::requiresMarching() const {
+    return true;
+}
+
+const Shape* CompoundShape::surfaceShape(glm::vec4 worldPosition) const {
+    int leafIndex;
+    m_tape.evaluate(m_ctm_inverse * worldPosition, 0.0f, leafIndex);
+    return m_tape.leaves()[leafIndex];
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+#include "raytracer/intersect.h"
+#include "raytracer/sdfgraph.h"
+
+/**
+ * An SDF group from the scene file (a node with an <operation> or <repeat>), marched as a single shape.
+ * Its members are combined by an SDFTape compiled from the group's subtree.
+ *
+ * Hits are resolved to the member that decided the distance, so members keep their own materials. Members
+ * don't follow their bezier curves, since the tape bakes in their positions.
+ */
+class CompoundShape final: public Shape {
+public:
+    // node's own transformations must already be part of ctm. The members are created in the arena. Throws
+    // std::invalid_argument if the group has no primitives, and std::runtime_error if it's too deep to compile.
+    CompoundShape(const SceneNode* node, glm::mat4 ctm, SceneArena& arena);
+    ~CompoundShape() = default;
+
+    // Without ray marching, a group is intersected as the plain union of its analytic members
+    std::optional<Intersect> intersect(Ray ray) const override;
+    glm::vec3 getNormal(glm::vec4 position) const override;
+    float shapeSDF(glm::vec4 position) const override;
+    float shapeSDFLod(glm::vec4 position, float footprint) const override;
+    TextureMap getTextureMap(glm::vec4 position) const override;
+    float boundingRadius() const override;
+    bool requiresMarching() const override;
+    const Shape* surfaceShape(glm::vec4 worldPosition) const override;
+
+private:
+    std::vector<Shape*> m_members; // Owned by the scene's arena
+    SDFTape m_tape;
+    float m_boundingRadius = 0.0f;
+
+    SDFNode buildGroup(const SceneNode* node, glm::mat4 localCtm, SceneArena& arena);
+};
@@ -78,3 +78,7 @@ TextureMap Cone::getTextureMap(glm::vec4 position) const{
         return TextureMap{u, v};
     }
 }
+
+float Cone::boundingRadius() const {
+    return std::sqrt(m_radius * m_radius + m_height * m_height / 4.0f);
+}
@@ -4,13 +4,14 @@
 
 class Cone final: public Shape {
 public:
-    Cone(ScenePrimitive primative, glm::mat4 ctm, float minScale): Shape(primative, ctm, minScale) {}
+    Cone(ShapeData data, glm::mat4 ctm): Shape(data, ctm) {}
     ~Cone() = default;
 
     std::optional<Intersect> intersect(Ray ray) const override;
     glm::vec3 getNormal(glm::vec4 position) const override;
     float shapeSDF(glm::vec4 position) const override;
     TextureMap getTextureMap(glm::vec4 position) const override;
+    float boundingRadius() const override;
 
 private:
     float m_height = 1.0f;
@@ -12,7 +12,7 @@ std::optional<Intersect> Cube::intersect(Ray ray) const{
     // Top face, y = 1/2
     float t_top = (0.5f - ray.p.y) / ray.d.y;
     glm::vec4 top_pos = ray.evaluate(t_top);
-    if(abs(top_pos.x) < 0.5 && abs(top_pos.z) < 0.5){
+    if(std::abs(top_pos.x) < 0.5 && std::abs(top_pos.z) < 0.5){
         std::vector<float> blends{1.0f};
         std::vector<const Shape*> shapeVec;
         shapeVec.emplace_back(this);
@@ -23,7 +23,7 @@ std::optional<Intersect> Cube::intersect(Ray ray) const{
     // Bottom face, y = -1/2
     float t_bottom = (-0.5f - ray.p.y) / ray.d.y;
     glm::vec4 bottom_pos = ray.evaluate(t_bottom);
-    if(abs(bottom_pos.x) < 0.5 && abs(bottom_pos.z) < 0.5){
+    if(std::abs(bottom_pos.x) < 0.5 && std::abs(bottom_pos.z) < 0.5){
         std::vector<float> blends{1.0f};
         std::vector<const Shape*> shapeVec;
         shapeVec.emplace_back(this);
@@ -34,7 +34,7 @@ std::optional<Intersect> Cube::intersect(Ray ray) const{
     // Left face, z = -1/2
     float t_left = (-0.5f - ray.p.z) / ray.d.z;
     glm::vec4 left_pos = ray.evaluate(t_left);
-    if(abs(left_pos.x) < 0.5 && abs(left_pos.y) < 0.5){
+    if(std::abs(left_pos.x) < 0.5 && std::abs(left_pos.y) < 0.5){
         std::vector<float> blends{1.0f};
         std::vector<const Shape*> shapeVec;
         shapeVec.emplace_back(this);
@@ -46,7 +46,7 @@ std::optional<Intersect> Cube::intersect(Ray ray) const{
     // Right face, z = 1/2
     float t_right = (0.5f - ray.p.z) / ray.d.z;
     glm::vec4 right_pos = ray.evaluate(t_right);
-    if(abs(right_pos.x) < 0.5 && abs(right_pos.y) < 0.5){
+    if(std::abs(right_pos.x) < 0.5 && std::abs(right_pos.y) < 0.5){
         std::vector<float> blends{1.0f};
         std::vector<const Shape*> shapeVec;
         shapeVec.emplace_back(this);
@@ -57,7 +57,7 @@ std::optional<Intersect> Cube::intersect(Ray ray) const{
     // Front face, x = 1/2
     float t_front = (0.5f - ray.p.x) / ray.d.x;
     glm::vec4 front_pos = ray.evaluate(t_front);
-    if(abs(front_pos.z) < 0.5 && abs(front_pos.y) < 0.5){
+    if(std::abs(front_pos.z) < 0.5 && std::abs(front_pos.y) < 0.5){
         std::vector<float> blends{1.0f};
         std::vector<const Shape*> shapeVec;
         shapeVec.emplace_back(this);
@@ -68,7 +68,7 @@ std::optional<Intersect> Cube::intersect(Ray ray) const{
     // Back face, x = -1/2
     float t_back = (-0.5f - ray.p.x) / ray.d.x;
     glm::vec4 back_pos = ray.evaluate(t_back);
-    if(abs(back_pos.z) < 0.5 && abs(back_pos.y) < 0.5){
+    if(std::abs(back_pos.z) < 0.5 && std::abs(back_pos.y) < 0.5){
         std::vector<float> blends{1.0f};
         std::vector<const Shape*> shapeVec;
         shapeVec.emplace_back(this);
@@ -105,7 +105,7 @@ glm::vec3 Cube::getNormal(glm::vec4 position) const{
 }
 
 float Cube::shapeSDF(glm::vec4 position) const {
-    glm::vec3 q = glm::vec3(abs(position[0]), abs(position[1]), abs(position[2])) - sideLengths;
+    glm::vec3 q = glm::vec3(std::abs(position[0]), std::abs(position[1]), std::abs(position[2])) - sideLengths;
 
     return glm::length(glm::vec3(std::max(q[0], 0.0f), std::max(q[1], 0.0f), std::max(q[2], 0.0f)))
             + std::min(std::max(q[0],std::max(q[1],q[2])), 0.0f);
@@ -135,3 +135,7 @@ TextureMap Cube::getTextureMap(glm::vec4 position) const{
     // Should never have this case, assuming we are on the surface of the object
     return TextureMap{0, 0};
 }
+
+float Cube::boundingRadius() const {
+    return glm::length(sideLengths);
+}
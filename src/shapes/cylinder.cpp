@@ -86,3 +86,7 @@ TextureMap Cylinder::getTextureMap(glm::vec4 position) const{
         return TextureMap{u, v};
     }
 }
+
+float Cylinder::boundingRadius() const {
+    return std::sqrt(m_radius * m_radius + m_height * m_height / 4.0f);
+}
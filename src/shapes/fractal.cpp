@@ -1,18 +1,21 @@
+#include <algorithm>
 #include "fractal.h"
+#include "fractalsimd.h"
+#include "utils/fractalsettings.h"
 
 std::optional<Intersect> Fractal::intersect(Ray ray) const {
     // Should never actual be used: Fractals only support raymarching
     throw std::runtime_error("Error: Fractals only support raymarching.");
 }
 
-float Fractal::mandelbulbSDF(glm::vec4 p) const {
+float Fractal::mandelbulbSDF(glm::vec4 p, int iterations) const {
     glm::vec3 w = p;
     float m = dot(w,w);
 
     glm::vec4 trap = glm::vec4(abs(w),m);
     float dz = 1.0;
 
-    for( int i=0; i<20; i++ )
+    for( int i=0; i<iterations; i++ )
     {
         // polynomial version (no trigonometrics, but MUCH slower)
         float m2 = m*m;
@@ -35,7 +38,7 @@ float Fractal::mandelbulbSDF(glm::vec4 p) const {
         trap = min( trap, glm::vec4(abs(w),m) );
 
         m = dot(w,w);
-        if( m > 256.0 )
+        if( m > MANDELBULB_BAILOUT )
             break;
     }
 
@@ -60,17 +63,14 @@ glm::vec3 box (glm::vec3 z) {
   return glm::clamp(z, -1.0f, 1.0f) * 2.0f - z;
 }
 
-const int ITERATIONS = 30;
-const float SCALE = 2.5;
-
-float Fractal::mandelboxSDF(glm::vec3 pos) const{
-    const float c1 = glm::abs(SCALE - 1.0);
-    const float c2 = glm::pow(glm::abs(SCALE), 1.0 - ITERATIONS);
+float Fractal::mandelboxSDF(glm::vec3 pos, int iterations) const{
+    const float c1 = glm::abs(MANDELBOX_SCALE - 1.0);
+    const float c2 = glm::pow(glm::abs(MANDELBOX_SCALE), 1.0 - iterations);
     const glm::vec3 c = pos;
     glm::vec3 v = pos;
     float dr = 1.0;
 
-    for (int i = 0; i < ITERATIONS; i++) {
+    for (int i = 0; i < iterations; i++) {
        glm::vec3 old = v;
        v = glm::max(v, glm::vec3{-1.0, -1.0, -1.0});
        v = glm::min(v, glm::vec3{1.0, 1.0, 1.0});
@@ -86,22 +86,20 @@ float Fractal::mandelboxSDF(glm::vec3 pos) const{
            dr = dr / mag;
        }
 
-       v = SCALE * v + c;
-       dr = dr * glm::abs(SCALE) + 1.0;
+       v = MANDELBOX_SCALE * v + c;
+       dr = dr * glm::abs(MANDELBOX_SCALE) + 1.0;
    }
 
    return (glm::length(v) - c1) / dr - c2;
 }
 
-float Fractal::serpinskiSDF(glm::vec3 z) const{
-    float iterations = 15.0;
-    float Scale = 2.0;
-    float Offset = 3.0;
-    float i = 0.0;
+float Fractal::serpinskiSDF(glm::vec3 z, int iterations) const{
+    float Scale = SERPINSKI_SCALE;
+    float Offset = SERPINSKI_OFFSET;
 
     float r;
     int n = 0;
-    while (n < int (iterations)) {
+    while (n < iterations) {
         if (z.x + z.y < 0.0) {
             // fold 1
             float t = z.x;
@@ -127,16 +125,91 @@ float Fractal::serpinskiSDF(glm::vec3 z) const{
 }
 
 float Fractal::shapeSDF(glm::vec4 p) const {
+    return shapeSDFLod(p, 0.0f);
+}
+
+float Fractal::shapeSDFLod(glm::vec4 p, float footprint) const {
+    if (m_volume) {
+        float bound = m_volume->lowerBound(p);
+        if (bound > m_volume->exactThreshold())
+            return bound;
+    }
+
+    int iterations = iterationBudget(footprint);
+    switch(m_type){
+    case FractalType::MANDELBULB:
+        return mandelbulbSDF(p, iterations);
+    case FractalType::MANDELBOX:
+        return mandelboxSDF(p, iterations);
+    case FractalType::SERPINSKI:
+        return serpinskiSDF(p, iterations);
+    }
+    return 0.0f;
+}
+
+void Fractal::shapeSDFBatch(const glm::vec4* positions, float* out, int count, float footprint) const {
+    int iterations = iterationBudget(footprint);
     switch(m_type){
     case FractalType::MANDELBULB:
-        return mandelbulbSDF(p);
+        return mandelbulbSDFBatch(positions, out, count, iterations);
     case FractalType::MANDELBOX:
-        return mandelboxSDF(p);
+        return mandelboxSDFBatch(positions, out, count, iterations);
     case FractalType::SERPINSKI:
-        return serpinskiSDF(p);
+        return serpinskiSDFBatch(positions, out, count, iterations);
     }
 }
 
+std::string Fractal::volumeKey() const {
+    switch(m_type){
+    case FractalType::MANDELBULB:
+        return "mandelbulb-" + std::to_string(fractalSettings.mandelbulbIterations);
+    case FractalType::MANDELBOX:
+        return "mandelbox-" + std::to_string(fractalSettings.mandelboxIterations);
+    case FractalType::SERPINSKI:
+        return "serpinski-" + std::to_string(fractalSettings.serpinskiIterations);
+    }
+    return "";
+}
+
+void Fractal::setVolume(std::shared_ptr<const SDFVolume> volume) {
+    m_volume = std::move(volume);
+}
+
+// Never go below this many iterations, since the first few barely resemble the fractal
+const static int MIN_LOD_ITERATIONS = 3;
+// Extra iterations on top of the estimate, so the cut off detail is well below a pixel
+const static int LOD_ITERATION_MARGIN = 2;
+
+int Fractal::iterationBudget(float footprint) const {
+    // No iterations for a type that isn't listed below
+    int maxIterations = 0;
+    // How much finer the detail added by each iteration is than that of the previous one
+    float detailRate = 2.0f;
+    switch(m_type){
+    case FractalType::MANDELBULB:
+        maxIterations = fractalSettings.mandelbulbIterations;
+        detailRate = 4.0f; // The power 8 map grows distances by ~8x, halved to stay conservative
+        break;
+    case FractalType::MANDELBOX:
+        maxIterations = fractalSettings.mandelboxIterations;
+        detailRate = MANDELBOX_SCALE;
+        break;
+    case FractalType::SERPINSKI:
+        maxIterations = fractalSettings.serpinskiIterations;
+        detailRate = SERPINSKI_SCALE;
+        break;
+    }
+
+    footprint *= fractalSettings.lodScale;
+    if (!fractalSettings.lodEnabled || footprint <= 0)
+        return maxIterations;
+
+    // Detail after n iterations is roughly boundingRadius / detailRate^n
+    float levels = std::log(boundingRadius() / footprint) / std::log(detailRate);
+    int budget = (int)std::ceil(levels) + LOD_ITERATION_MARGIN;
+    return std::clamp(budget, std::min(MIN_LOD_ITERATIONS, maxIterations), maxIterations);
+}
+
 TextureMap Fractal::getTextureMap(glm::vec4 position) const{
     position = m_ctm_inverse * position;
     // Get phi and theta angles, extrapolate from there
@@ -160,3 +233,34 @@ glm::vec3 Fractal::getNormal(glm::vec4 position) const{
     // Change object normal to world normal.
     return objectToWorldNormal(objectNormal, this);
 }
+
+bool Fractal::requiresMarching() const {
+    return true;
+}
+
+float Fractal::boundingRadius() const {
+    switch(m_type){
+    case FractalType::MANDELBULB:
+        // The power 8 bulb lies within r ~ 1.15
+        return 1.25f;
+    case FractalType::MANDELBOX:
+        // Orbits outside the cube of half-width 2(s+1)/(s-1) always escape
+        return std::sqrt(3.0f) * 2.0f * (MANDELBOX_SCALE + 1.0f) / (MANDELBOX_SCALE - 1.0f);
+    case FractalType::SERPINSKI:
+        // Tetrahedron with vertices at (+-offset, +-offset, +-offset)
+        return SERPINSKI_OFFSET * std::sqrt(3.0f);
+    }
+    return std::numeric_limits<float>::infinity();
+}
+
+float Fractal::lipschitzBound() const {
+    switch(m_type){
+    case FractalType::MANDELBULB:
+        return MANDELBULB_LIPSCHITZ;
+    case FractalType::MANDELBOX:
+        return MANDELBOX_LIPSCHITZ;
+    case FractalType::SERPINSKI:
+        return SERPINSKI_LIPSCHITZ;
+    }
+    return 1.0f;
+}
@@ -1,25 +1,51 @@
 #pragma once
 
 #include "raytracer/intersect.h"
+#include "raytracer/sdfvolume.h"
 
+// Constants shared by the scalar and batched (fractalsimd.cpp) fractal SDFs
+const float MANDELBULB_BAILOUT = 256.0f;
+const float MANDELBOX_SCALE = 2.5f;
+const float SERPINSKI_SCALE = 2.0f;
+const float SERPINSKI_OFFSET = 3.0f;
 
+// Lipschitz bounds of the distance estimates. The Serpinski estimate is the distance to a point folded by
+// reflections, so it is exact. The Mandelbox estimate changes up to ~1.07x faster than distance (sampled over its
+// bounding sphere). The Mandelbulb estimate has no finite bound right at the set (it jumps across filaments), so
+// it keeps the usual 1.
+const float MANDELBULB_LIPSCHITZ = 1.0f;
+const float MANDELBOX_LIPSCHITZ = 1.1f;
+const float SERPINSKI_LIPSCHITZ = 1.0f;
 
 class Fractal final: public Shape {
 public:
-    Fractal(ScenePrimitive primative, glm::mat4 ctm, float minScale, FractalType type): Shape(primative, ctm, minScale), m_type(type) {}
+    Fractal(ShapeData data, glm::mat4 ctm, FractalType type): Shape(data, ctm), m_type(type) {}
     ~Fractal() = default;
 
     std::optional<Intersect> intersect(Ray ray) const override;
     glm::vec3 getNormal(glm::vec4 position) const override;
     float shapeSDF(glm::vec4 position) const override;
+    float shapeSDFLod(glm::vec4 position, float footprint) const override;
+    void shapeSDFBatch(const glm::vec4* positions, float* out, int count, float footprint) const override;
 
     // Specific shape SDFs
-    float mandelbulbSDF(glm::vec4 p) const;
-    float mandelboxSDF(glm::vec3 p) const;
-    float serpinskiSDF(glm::vec3 p) const;
+    float mandelbulbSDF(glm::vec4 p, int iterations) const;
+    float mandelboxSDF(glm::vec3 p, int iterations) const;
+    float serpinskiSDF(glm::vec3 p, int iterations) const;
+
+    // The number of iterations needed to resolve detail down to footprint (in object space units)
+    int iterationBudget(float footprint) const;
+
+    // Identifies fractals with the same SDF, for sharing baked volumes
+    std::string volumeKey() const;
+    // Far from the surface, shapeSDF(Lod) step by lookups into this volume instead of iterating
+    void setVolume(std::shared_ptr<const SDFVolume> volume);
 
     TextureMap getTextureMap(glm::vec4 position) const override;
+    float boundingRadius() const override;
+    bool requiresMarching() const override;
+    float lipschitzBound() const override;
 private:
-    int m_numIterations = 50;
     FractalType m_type;
+    std::shared_ptr<const SDFVolume> m_volume;
 };
@@ -0,0 +1,263 @@
+#include "fractalsimd.h"
+#include "fractal.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+/*
+ * A minimal wrapper around the widest float vector the target supports, so that each fractal kernel
+ * only has to be written once.
+ */
+#if defined(__AVX2__)
+
+struct MaskN {
+    __m256 v;
+};
+
+struct FloatN {
+    static constexpr int WIDTH = 8;
+    __m256 v;
+
+    FloatN(__m256 value): v(value) {}
+    FloatN(float value): v(_mm256_set1_ps(value)) {}
+
+    static FloatN load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline FloatN operator+(FloatN a, FloatN b) { return _mm256_add_ps(a.v, b.v); }
+inline FloatN operator-(FloatN a, FloatN b) { return _mm256_sub_ps(a.v, b.v); }
+inline FloatN operator*(FloatN a, FloatN b) { return _mm256_mul_ps(a.v, b.v); }
+inline FloatN operator/(FloatN a, FloatN b) { return _mm256_div_ps(a.v, b.v); }
+inline FloatN operator-(FloatN a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+inline FloatN min(FloatN a, FloatN b) { return _mm256_min_ps(a.v, b.v); }
+inline FloatN max(FloatN a, FloatN b) { return _mm256_max_ps(a.v, b.v); }
+inline FloatN sqrt(FloatN a) { return _mm256_sqrt_ps(a.v); }
+
+inline MaskN operator<(FloatN a, FloatN b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline MaskN operator<=(FloatN a, FloatN b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline MaskN operator&(MaskN a, MaskN b) { return {_mm256_and_ps(a.v, b.v)}; }
+inline MaskN allLanes() { return {_mm256_castsi256_ps(_mm256_set1_epi32(-1))}; }
+inline bool any(MaskN m) { return _mm256_movemask_ps(m.v) != 0; }
+// a where the mask is set, b elsewhere
+inline FloatN select(MaskN m, FloatN a, FloatN b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+struct MaskN {
+    __m128 v;
+};
+
+struct FloatN {
+    static constexpr int WIDTH = 4;
+    __m128 v;
+
+    FloatN(__m128 value): v(value) {}
+    FloatN(float value): v(_mm_set1_ps(value)) {}
+
+    static FloatN load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline FloatN operator+(FloatN a, FloatN b) { return _mm_add_ps(a.v, b.v); }
+inline FloatN operator-(FloatN a, FloatN b) { return _mm_sub_ps(a.v, b.v); }
+inline FloatN operator*(FloatN a, FloatN b) { return _mm_mul_ps(a.v, b.v); }
+inline FloatN operator/(FloatN a, FloatN b) { return _mm_div_ps(a.v, b.v); }
+inline FloatN operator-(FloatN a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline FloatN min(FloatN a, FloatN b) { return _mm_min_ps(a.v, b.v); }
+inline FloatN max(FloatN a, FloatN b) { return _mm_max_ps(a.v, b.v); }
+inline FloatN sqrt(FloatN a) { return _mm_sqrt_ps(a.v); }
+
+inline MaskN operator<(FloatN a, FloatN b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline MaskN operator<=(FloatN a, FloatN b) { return {_mm_cmple_ps(a.v, b.v)}; }
+inline MaskN operator&(MaskN a, MaskN b) { return {_mm_and_ps(a.v, b.v)}; }
+inline MaskN allLanes() { return {_mm_castsi128_ps(_mm_set1_epi32(-1))}; }
+inline bool any(MaskN m) { return _mm_movemask_ps(m.v) != 0; }
+// a where the mask is set, b elsewhere
+inline FloatN select(MaskN m, FloatN a, FloatN b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+
+#else
+
+// Scalar fallback for targets without SSE
+struct MaskN {
+    bool v;
+};
+
+struct FloatN {
+    static constexpr int WIDTH = 1;
+    float v;
+
+    FloatN(float value): v(value) {}
+
+    static FloatN load(const float* p) { return *p; }
+    void store(float* p) const { *p = v; }
+};
+
+inline FloatN operator+(FloatN a, FloatN b) { return a.v + b.v; }
+inline FloatN operator-(FloatN a, FloatN b) { return a.v - b.v; }
+inline FloatN operator*(FloatN a, FloatN b) { return a.v * b.v; }
+inline FloatN operator/(FloatN a, FloatN b) { return a.v / b.v; }
+inline FloatN operator-(FloatN a) { return -a.v; }
+inline FloatN min(FloatN a, FloatN b) { return std::min(a.v, b.v); }
+inline FloatN max(FloatN a, FloatN b) { return std::max(a.v, b.v); }
+inline FloatN sqrt(FloatN a) { return std::sqrt(a.v); }
+
+inline MaskN operator<(FloatN a, FloatN b) { return {a.v < b.v}; }
+inline MaskN operator<=(FloatN a, FloatN b) { return {a.v <= b.v}; }
+inline MaskN operator&(MaskN a, MaskN b) { return {a.v && b.v}; }
+inline MaskN allLanes() { return {true}; }
+inline bool any(MaskN m) { return m.v; }
+inline FloatN select(MaskN m, FloatN a, FloatN b) { return m.v ? a : b; }
+
+#endif
+
+static constexpr int WIDTH = FloatN::WIDTH;
+
+int fractalSIMDWidth() {
+    return WIDTH;
+}
+
+/**
+ * Splits count points into groups of WIDTH lanes, transposing them to one vector per coordinate.
+ * The last group is padded with copies of the last point, and only the real lanes are written back.
+ */
+template <typename Kernel>
+void forEachLaneGroup(const glm::vec4* points, float* out, int count, Kernel kernel) {
+    for (int start = 0; start < count; start += WIDTH) {
+        float xs[WIDTH], ys[WIDTH], zs[WIDTH], result[WIDTH];
+        for (int lane = 0; lane < WIDTH; lane++) {
+            const glm::vec4& p = points[std::min(start + lane, count - 1)];
+            xs[lane] = p.x;
+            ys[lane] = p.y;
+            zs[lane] = p.z;
+        }
+
+        kernel(FloatN::load(xs), FloatN::load(ys), FloatN::load(zs), result);
+
+        for (int lane = 0; lane < WIDTH && start + lane < count; lane++) {
+            out[start + lane] = result[lane];
+        }
+    }
+}
+
+void mandelbulbSDFBatch(const glm::vec4* points, float* out, int count, int iterations) {
+    forEachLaneGroup(points, out, count, [iterations](FloatN px, FloatN py, FloatN pz, float* result) {
+        FloatN wx = px, wy = py, wz = pz;
+        FloatN m = wx*wx + wy*wy + wz*wz;
+        FloatN dz = 1.0f;
+
+        // Lanes drop out of the mask once they escape, and keep their values from that iteration
+        MaskN active = allLanes();
+        for (int i = 0; i < iterations && any(active); i++) {
+            FloatN m2 = m*m;
+            FloatN m4 = m2*m2;
+            FloatN newDz = FloatN(8.0f)*sqrt(m4*m2*m)*dz + FloatN(1.0f);
+
+            FloatN x = wx; FloatN x2 = x*x; FloatN x4 = x2*x2;
+            FloatN y = wy; FloatN y2 = y*y; FloatN y4 = y2*y2;
+            FloatN z = wz; FloatN z2 = z*z; FloatN z4 = z2*z2;
+
+            FloatN k3 = x2 + z2;
+            FloatN k3Squared = k3*k3;
+            FloatN k2 = FloatN(1.0f) / sqrt(k3Squared*k3Squared*k3Squared*k3);
+            FloatN k1 = x4 + y4 + z4 - FloatN(6.0f)*y2*z2 - FloatN(6.0f)*x2*y2 + FloatN(2.0f)*z2*x2;
+            FloatN k4 = x2 - y2 + z2;
+
+            FloatN newX = px + FloatN(64.0f)*x*y*z*(x2 - z2)*k4*(x4 - FloatN(6.0f)*x2*z2 + z4)*k1*k2;
+            FloatN newY = py - FloatN(16.0f)*y2*k3*k4*k4 + k1*k1;
+            FloatN newZ = pz - FloatN(8.0f)*y*k4*(x4*x4 - FloatN(28.0f)*x4*x2*z2 + FloatN(70.0f)*x4*z4
+                                                 - FloatN(28.0f)*x2*z2*z4 + z4*z4)*k1*k2;
+
+            wx = select(active, newX, wx);
+            wy = select(active, newY, wy);
+            wz = select(active, newZ, wz);
+            dz = select(active, newDz, dz);
+            m = wx*wx + wy*wy + wz*wz;
+
+            active = active & (m <= FloatN(MANDELBULB_BAILOUT));
+        }
+
+        // No vector log, so the (cheap) final distance estimate is done per lane
+        float ms[WIDTH], dzs[WIDTH];
+        m.store(ms);
+        dz.store(dzs);
+        for (int lane = 0; lane < WIDTH; lane++) {
+            result[lane] = 0.25f * std::log(ms[lane]) * std::sqrt(ms[lane]) / dzs[lane];
+        }
+    });
+}
+
+void mandelboxSDFBatch(const glm::vec4* points, float* out, int count, int iterations) {
+    const float c1 = std::abs(MANDELBOX_SCALE - 1.0f);
+    const float c2 = std::pow(std::abs(MANDELBOX_SCALE), 1.0f - iterations);
+
+    forEachLaneGroup(points, out, count, [c1, c2, iterations](FloatN cx, FloatN cy, FloatN cz, float* result) {
+        FloatN vx = cx, vy = cy, vz = cz;
+        FloatN dr = 1.0f;
+        const FloatN one = 1.0f;
+        const FloatN scale = MANDELBOX_SCALE;
+
+        for (int i = 0; i < iterations; i++) {
+            // Box fold
+            vx = max(min(vx, one), -one) * FloatN(2.0f) - vx;
+            vy = max(min(vy, one), -one) * FloatN(2.0f) - vy;
+            vz = max(min(vz, one), -one) * FloatN(2.0f) - vz;
+
+            // Sphere fold, picking the factor per lane
+            FloatN mag = vx*vx + vy*vy + vz*vz;
+            FloatN factor = select(mag < FloatN(0.25f), FloatN(4.0f), select(mag < one, one / mag, one));
+            vx = vx * factor;
+            vy = vy * factor;
+            vz = vz * factor;
+            dr = dr * factor;
+
+            vx = scale * vx + cx;
+            vy = scale * vy + cy;
+            vz = scale * vz + cz;
+            dr = dr * FloatN(std::abs(MANDELBOX_SCALE)) + one;
+        }
+
+        FloatN distance = (sqrt(vx*vx + vy*vy + vz*vz) - FloatN(c1)) / dr - FloatN(c2);
+        distance.store(result);
+    });
+}
+
+void serpinskiSDFBatch(const glm::vec4* points, float* out, int count, int iterations) {
+    const float scale = SERPINSKI_SCALE;
+    const float offset = SERPINSKI_OFFSET;
+
+    forEachLaneGroup(points, out, count, [&](FloatN x, FloatN y, FloatN z, float* result) {
+        const FloatN zero = 0.0f;
+
+        for (int n = 0; n < iterations; n++) {
+            // Each fold reflects the lanes that are on the wrong side of its plane
+            MaskN fold1 = (x + y) < zero;
+            FloatN t = x;
+            x = select(fold1, -y, x);
+            y = select(fold1, -t, y);
+
+            MaskN fold2 = (x + z) < zero;
+            t = z;
+            z = select(fold2, -x, z);
+            x = select(fold2, -t, x);
+
+            MaskN fold3 = (y + z) < zero;
+            t = y;
+            y = select(fold3, -z, y);
+            z = select(fold3, -t, z);
+
+            x = x * FloatN(scale) - FloatN(offset * (scale - 1.0f));
+            y = y * FloatN(scale) - FloatN(offset * (scale - 1.0f));
+            z = z * FloatN(scale) - FloatN(offset * (scale - 1.0f));
+        }
+
+        FloatN distance = sqrt(x*x + y*y + z*z) * FloatN(std::pow(scale, -float(iterations)));
+        distance.store(result);
+    });
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+/**
+ * Batched versions of the fractal SDFs in fractal.cpp, which evaluate several object space points at once
+ * (8 per instruction with AVX2, 4 with SSE2, otherwise one at a time).
+ *
+ * Lanes that escape early (mandelbulb) are masked off while the rest keep iterating, so every point gets the
+ * same result as the scalar Fractal::*SDF functions, up to float rounding. Near the mandelbulb that rounding is
+ * amplified by each iteration, so there the two only agree for the first few (tests/fractalsimdtest.cpp).
+ *
+ * @param points     The object space points to evaluate (w is ignored)
+ * @param out        Filled with one distance per point
+ * @param count      The number of points
+ * @param iterations The number of fractal iterations to run (see Fractal::iterationBudget)
+ */
+void mandelbulbSDFBatch(const glm::vec4* points, float* out, int count, int iterations);
+void mandelboxSDFBatch(const glm::vec4* points, float* out, int count, int iterations);
+void serpinskiSDFBatch(const glm::vec4* points, float* out, int count, int iterations);
+
+// The number of points evaluated together by the batched SDFs
+int fractalSIMDWidth();
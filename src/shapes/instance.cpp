@@ -0,0 +1,154 @@
+#include <limits>
+#include "instance.h"
+#include "utils/sceneparser.h"
+#include "utils/scenefilereader.h"
+
+// Counts the object's shapes, or returns -1 if any of them can't be placed in a shared prototype
+static int countShareableShapes(const SceneNode* node) {
+    if (node->operation != nullptr)
+        return -1;
+
+    int count = 0;
+    for (const ScenePrimitive* primitive : node->primitives) {
+        if (primitive->useBezierCurves)
+            return -1;
+        count++;
+    }
+    for (const SceneNode* child : node->children) {
+        int childCount = countShareableShapes(child);
+        if (childCount < 0)
+            return -1;
+        count += childCount;
+    }
+    return count;
+}
+
+// Makes the members of a prototype as the object is flattened in its own space. Objects it refers to are expanded
+// into it.
+class PrototypeBuilder : public SceneSink {
+public:
+    PrototypeBuilder(InstancePrototype& prototype, SceneArena& arena): m_prototype(prototype), m_arena(arena) {}
+
+    void addPrimitive(const ScenePrimitive& primitive, glm::mat4 ctm) override {
+        Shape* member = makeShape(m_arena, primitive, ctm);
+        m_prototype.members.push_back(member);
+        m_prototype.requiresMarching = m_prototype.requiresMarching || member->requiresMarching();
+
+        float reach = glm::length(glm::vec3(member->getWorldBoundCenter())) + member->getWorldBoundRadius();
+        m_prototype.boundingRadius = std::max(m_prototype.boundingRadius, reach);
+    }
+
+    // Never called: objects with SDF groups don't get a prototype (see countShareableShapes)
+    void addGroup(const SceneNode* /*group*/, glm::mat4 /*ctm*/) override {}
+
+private:
+    InstancePrototype& m_prototype;
+    SceneArena& m_arena;
+};
+
+std::shared_ptr<const InstancePrototype> InstancePrototype::build(const SceneNode* object, SceneArena& arena) {
+    if (countShareableShapes(object) < 2)
+        return nullptr;
+
+    auto prototype = std::make_shared<InstancePrototype>();
+    PrototypeBuilder builder(*prototype, arena);
+    flattenSceneGraph(object, glm::mat4(1), builder);
+    return prototype;
+}
+
+InstanceShape::InstanceShape(std::shared_ptr<const InstancePrototype> prototype, glm::mat4 ctm):
+    Shape(ShapeData{prototype->members[0]->m_material}, ctm), m_prototype(std::move(prototype)) {}
+
+std::optional<Intersect> InstanceShape::intersect(Ray ray) const {
+    std::optional<Intersect> intersection = std::nullopt;
+
+    // The ray is already in the prototype's space, so rays that miss its bounds skip all of its members
+    float radius = m_prototype->boundingRadius;
+    if (!std::isinf(radius)) {
+        glm::vec3 p = ray.p;
+        glm::vec3 d = ray.d;
+        float b = glm::dot(p, d);
+        float c = glm::dot(p, p) - radius * radius;
+        if (b * b - glm::dot(d, d) * c < 0 || (b > 0 && c > 0))
+            return intersection;
+    }
+
+    for (const Shape* member : m_prototype->members) {
+        if (member->requiresMarching())
+            continue;
+        Ray memberRay{member->m_ctm_inverse * ray.p, member->m_ctm_inverse * ray.d};
+        std::optional<Intersect> memberIntersection = member->intersect(memberRay);
+        if (memberIntersection.has_value())
+            replaceIntercept(intersection, memberIntersection.value());
+    }
+
+    // Members give their normals in the prototype's space
+    if (intersection.has_value()) {
+        intersection.value().normal = objectToWorldNormal(intersection.value().normal, this);
+        intersection.value().shape.instance = this;
+    }
+    return intersection;
+}
+
+glm::vec3 InstanceShape::getNormal(glm::vec4 position) const {
+    const float smallStep = 0.001;
+    glm::vec3 objectNormal{
+        shapeSDF(position + glm::vec4(smallStep, 0, 0, 0)) - shapeSDF(position - glm::vec4(smallStep, 0, 0, 0)),
+        shapeSDF(position + glm::vec4(0, smallStep, 0, 0)) - shapeSDF(position - glm::vec4(0, smallStep, 0, 0)),
+        shapeSDF(position + glm::vec4(0, 0, smallStep, 0)) - shapeSDF(position - glm::vec4(0, 0, smallStep, 0))
+    };
+    return objectToWorldNormal(objectNormal, this);
+}
+
+float InstanceShape::shapeSDF(glm::vec4 position) const {
+    return shapeSDFLod(position, 0.0f);
+}
+
+float InstanceShape::shapeSDFLod(glm::vec4 position, float footprint) const {
+    // The members' distances are scaled into the prototype's space the same way the scene's shapes are into the
+    // world, so the union stays a safe bound
+    float distance = std::numeric_limits<float>::infinity();
+    for (const Shape* member : m_prototype->members) {
+        glm::vec4 memberPosition = member->m_ctm_inverse * position;
+        distance = std::min(distance, member->shapeSDFLod(memberPosition, footprint / member->m_maxScale) * member->stepScale());
+    }
+    return distance;
+}
+
+TextureMap InstanceShape::getTextureMap(glm::vec4 position) const {
+    glm::vec4 prototypePosition = m_ctm_inverse * position;
+    return closestMember(prototypePosition)->getTextureMap(prototypePosition);
+}
+
+float InstanceShape::boundingRadius() const {
+    return m_prototype->boundingRadius;
+}
+
+bool InstanceShape::requiresMarching() const {
+    return m_prototype->requiresMarching;
+}
+
+const Shape* InstanceShape::surfaceShape(glm::vec4 worldPosition) const {
+    return closestMember(m_ctm_inverse * worldPosition);
+}
+
+bool InstanceShape::isInstance() const {
+    return true;
+}
+
+const std::vector<Shape*>& InstanceShape::members() const {
+    return m_prototype->members;
+}
+
+const Shape* InstanceShape::closestMember(glm::vec4 position) const {
+    const Shape* closest = m_prototype->members[0];
+    float closestDistance = std::numeric_limits<float>::infinity();
+    for (const Shape* member : m_prototype->members) {
+        float distance = member->shapeSDF(member->m_ctm_inverse * position) * member->stepScale();
+        if (distance < closestDistance) {
+            closest = member;
+            closestDistance = distance;
+        }
+    }
+    return closest;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include "raytracer/intersect.h"
+
+// The shapes of a named object, built once in the object's own space and shared by every instance of it
+struct InstancePrototype {
+    std::vector<Shape*> members; // Owned by the scene's arena
+    float boundingRadius = 0.0f;
+    bool requiresMarching = false;
+
+    // Builds the prototype of the object in the arena. nullptr if the object can't be shared: if it has SDF groups
+    // or shapes that follow bezier curves (both need their own world positions), or has fewer than two shapes (an
+    // instance of a single shape is no smaller than the shape itself).
+    static std::shared_ptr<const InstancePrototype> build(const SceneNode* object, SceneArena& arena);
+};
+
+/**
+ * A named object placed in the scene by a transformation, sharing its prototype's shapes with every other instance
+ * of it instead of having copies of them. Rays are taken into the prototype's space by the instance's CTM, tested
+ * against the prototype's bounding sphere, and then against its members.
+ *
+ * Hits keep the member that was hit, for its material, and the instance they were hit through, since members are
+ * placed in the prototype's space rather than the world.
+ */
+class InstanceShape final: public Shape {
+public:
+    InstanceShape(std::shared_ptr<const InstancePrototype> prototype, glm::mat4 ctm);
+    ~InstanceShape() = default;
+
+    std::optional<Intersect> intersect(Ray ray) const override;
+    glm::vec3 getNormal(glm::vec4 position) const override;
+    float shapeSDF(glm::vec4 position) const override;
+    float shapeSDFLod(glm::vec4 position, float footprint) const override;
+    TextureMap getTextureMap(glm::vec4 position) const override;
+    float boundingRadius() const override;
+    bool requiresMarching() const override;
+    const Shape* surfaceShape(glm::vec4 worldPosition) const override;
+    bool isInstance() const override;
+
+    const std::vector<Shape*>& members() const;
+
+private:
+    std::shared_ptr<const InstancePrototype> m_prototype;
+
+    // The member closest to the point in the prototype's space
+    const Shape* closestMember(glm::vec4 position) const;
+};
@@ -60,3 +60,7 @@ glm::vec3 Sphere::getNormal(glm::vec4 position) const{
     // Change object normal to world normal.
     return objectToWorldNormal(objectNormal, this);
 }
+
+float Sphere::boundingRadius() const {
+    return 0.5f;
+}
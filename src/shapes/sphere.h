@@ -4,11 +4,12 @@
 
 class Sphere final: public Shape {
 public:
-    Sphere(ScenePrimitive primative, glm::mat4 ctm, float minScale): Shape(primative, ctm, minScale) {}
+    Sphere(ShapeData data, glm::mat4 ctm): Shape(data, ctm) {}
     ~Sphere() = default;
 
     std::optional<Intersect> intersect(Ray ray) const override;
     glm::vec3 getNormal(glm::vec4 position) const override;
     float shapeSDF(glm::vec4 position) const override;
     TextureMap getTextureMap(glm::vec4 position) const override;
+    float boundingRadius() const override;
 };
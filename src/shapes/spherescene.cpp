@@ -64,3 +64,13 @@ glm::vec3 SphereScene::getNormal(glm::vec4 position) const{
     // Change object normal to world normal.
     return objectToWorldNormal(objectNormal, this);
 }
+
+bool SphereScene::requiresMarching() const {
+    // intersect() only knows about the sphere at the origin, not its repetitions
+    return true;
+}
+
+float SphereScene::boundingRadius() const {
+    // The spheres repeat forever in x and z
+    return std::numeric_limits<float>::infinity();
+}
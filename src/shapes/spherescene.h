@@ -4,13 +4,15 @@
 
 class SphereScene final: public Shape {
 public:
-    SphereScene(ScenePrimitive primative, glm::mat4 ctm, float minScale): Shape(primative, ctm, minScale) {}
+    SphereScene(ShapeData data, glm::mat4 ctm): Shape(data, ctm) {}
     ~SphereScene() = default;
 
     std::optional<Intersect> intersect(Ray ray) const override;
     glm::vec3 getNormal(glm::vec4 position) const override;
     float shapeSDF(glm::vec4 position) const override;
     TextureMap getTextureMap(glm::vec4 position) const override;
+    float boundingRadius() const override;
+    bool requiresMarching() const override;
 private:
     float m_sphereRadius = 0.25;
     float m_sphereSeparation = 1;
@@ -22,9 +22,13 @@ size_t binom(size_t n, size_t k) noexcept
  * @return
  */
 glm::vec3 bezier(std::vector<glm::vec3>& points, float time){
-    int n = points.size() - 1;
+    return bezier(points.data(), points.size(), time);
+}
+
+glm::vec3 bezier(const glm::vec3* points, int numPoints, float time){
+    int n = numPoints - 1;
     glm::vec3 b {0,0,0};
-    for(int i = 0; i < points.size(); i++){
+    for(int i = 0; i < numPoints; i++){
         float coeff = binom(n, i) * std::pow(1 - time, n - i) * std::pow(time, i);
         b += coeff * points[i];
     }
@@ -11,6 +11,7 @@
  * @return
  */
 glm::vec3 bezier(std::vector<glm::vec3>& points, float time);
+glm::vec3 bezier(const glm::vec3* points, int numPoints, float time);
 
 glm::vec3 bezier_derivative(std::vector<glm::vec3>& points, float time);
 
@@ -0,0 +1,553 @@
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <type_traits>
+#include <unordered_map>
+#include "compiledscene.h"
+#include "scenefilereader.h"
+#include "sceneparser.h"
+#include "shapes/compound.h"
+#include "qfile.h"
+
+const static char FILE_MAGIC[4] = {'R', 'T', 'S', 'C'};
+const static int FILE_VERSION = 2;
+// Every array starts on this alignment, so it can be read in place from the mapped file
+const static std::size_t SECTION_ALIGNMENT = 16;
+// Groups are built recursively, so files with groups nested deeper than this are refused rather than risk the stack
+const static int MAX_GROUP_DEPTH = 256;
+
+namespace {
+
+// Where an array is in the file
+struct Section {
+    std::uint64_t offset;
+    std::uint64_t count;
+};
+
+struct CompiledCurve {
+    int firstPoint; // Among the control points
+    int numPoints;
+    float speed;
+};
+
+struct CompiledFileMap {
+    int isUsed;
+    int filename; // Offset into the strings
+    int filenameLength;
+    float repeatU;
+    float repeatV;
+};
+
+struct CompiledMaterial {
+    SceneColor cAmbient;
+    SceneColor cDiffuse;
+    SceneColor cSpecular;
+    SceneColor cReflective;
+    SceneColor cTransparent;
+    SceneColor cEmissive;
+    float shininess;
+    float ior;
+    float blend;
+    CompiledFileMap textureMap;
+    CompiledFileMap bumpMap;
+};
+
+struct CompiledPrimitive {
+    PrimitiveType type;
+    FractalType fractalType;
+    int material;
+    int curve; // -1 when the primitive doesn't follow a curve
+};
+
+// A node of an SDF group's subtree. A group's nodes are stored in pre-order.
+struct CompiledGroupNode {
+    glm::mat4 matrix; // The node's transformations, folded together
+    int hasOperation;
+    SDFOperationType operation;
+    float k;
+    glm::vec3 repeat;
+    int firstPrimitive;
+    int numPrimitives;
+    int numChildren;
+};
+
+struct CompiledShape {
+    glm::mat4 ctm;
+    int primitive; // -1 for an SDF group
+    int group;     // The group's root among the group nodes
+};
+
+struct CompiledCamera {
+    glm::vec4 pos;
+    glm::vec4 look;
+    glm::vec4 up;
+    float heightAngle;
+    float aperture;
+    float focalLength;
+    int curve; // -1 when the camera doesn't follow a curve
+    int useFocusPoint;
+    glm::vec3 focus;
+};
+
+// The size of each record in the file, so files written by a build that lays them out differently (another compiler
+// or GLM configuration) fail to load instead of being misread
+struct RecordSizes {
+    std::uint32_t header;
+    std::uint32_t light;
+    std::uint32_t material;
+    std::uint32_t curve;
+    std::uint32_t controlPoint;
+    std::uint32_t primitive;
+    std::uint32_t groupNode;
+    std::uint32_t shape;
+};
+
+struct CompiledSceneHeader {
+    char magic[4];
+    int version;
+    RecordSizes recordSizes;
+    SceneGlobalData globalData;
+    CompiledCamera camera;
+    Section lights;
+    Section materials;
+    Section curves;
+    Section controlPoints;
+    Section primitives;
+    Section groupNodes;
+    Section shapes;
+    Section strings;
+};
+
+// Collects the flattened shapes of a scene into the arrays of a compiled scene
+class SceneCompiler : public SceneSink {
+public:
+    std::vector<CompiledMaterial> materials;
+    std::vector<CompiledCurve> curves;
+    std::vector<glm::vec3> controlPoints;
+    std::vector<CompiledPrimitive> primitives;
+    std::vector<CompiledGroupNode> groupNodes;
+    std::vector<CompiledShape> shapes;
+    std::vector<char> strings;
+    // The most nodes from a group's root down to a leaf, over every group
+    int groupDepth = 0;
+
+    int addCurve(const std::vector<glm::vec3>& points, float speed) {
+        curves.push_back(CompiledCurve{(int)controlPoints.size(), (int)points.size(), speed});
+        controlPoints.insert(controlPoints.end(), points.begin(), points.end());
+        return curves.size() - 1;
+    }
+
+    void addPrimitive(const ScenePrimitive& primitive, glm::mat4 ctm) override {
+        shapes.push_back(CompiledShape{ctm, compilePrimitive(primitive), -1});
+    }
+
+    void addGroup(const SceneNode* group, glm::mat4 ctm) override {
+        // The root's transformations are already in the group's ctm
+        shapes.push_back(CompiledShape{ctm, -1, (int)groupNodes.size()});
+        addGroupNode(group, glm::mat4(1), 1);
+    }
+
+private:
+    // Deduplicates materials by the arena's shared copies
+    SceneArena m_arena;
+    std::unordered_map<const SceneMaterial*, int> m_materialIndices;
+    std::map<std::string, int> m_stringOffsets;
+
+    int addString(const std::string& string) {
+        auto [existing, inserted] = m_stringOffsets.emplace(string, strings.size());
+        if (inserted)
+            strings.insert(strings.end(), string.begin(), string.end());
+        return existing->second;
+    }
+
+    CompiledFileMap compileFileMap(const SceneFileMap& fileMap) {
+        return CompiledFileMap{fileMap.isUsed, addString(fileMap.filename), (int)fileMap.filename.size(),
+                               fileMap.repeatU, fileMap.repeatV};
+    }
+
+    int addMaterial(const SceneMaterial& material) {
+        auto [existing, inserted] = m_materialIndices.emplace(m_arena.material(material), materials.size());
+        if (!inserted)
+            return existing->second;
+
+        CompiledMaterial compiled{};
+        compiled.cAmbient = material.cAmbient;
+        compiled.cDiffuse = material.cDiffuse;
+        compiled.cSpecular = material.cSpecular;
+        compiled.cReflective = material.cReflective;
+        compiled.cTransparent = material.cTransparent;
+        compiled.cEmissive = material.cEmissive;
+        compiled.shininess = material.shininess;
+        compiled.ior = material.ior;
+        compiled.blend = material.blend;
+        compiled.textureMap = compileFileMap(material.textureMap);
+        compiled.bumpMap = compileFileMap(material.bumpMap);
+        materials.push_back(compiled);
+        return existing->second;
+    }
+
+    int compilePrimitive(const ScenePrimitive& primitive) {
+        CompiledPrimitive compiled{primitive.type, primitive.fractalType, addMaterial(primitive.material), -1};
+        if (primitive.useBezierCurves)
+            compiled.curve = addCurve(primitive.controlPoints, primitive.movementSpeed);
+        primitives.push_back(compiled);
+        return primitives.size() - 1;
+    }
+
+    void addGroupNode(const SceneNode* node, glm::mat4 matrix, int depth) {
+        groupDepth = std::max(groupDepth, depth);
+        CompiledGroupNode compiled{};
+        compiled.matrix = matrix;
+        if (node->operation != nullptr) {
+            compiled.hasOperation = true;
+            compiled.operation = node->operation->type;
+            compiled.k = node->operation->k;
+            compiled.repeat = node->operation->repeat;
+        }
+        compiled.firstPrimitive = primitives.size();
+        compiled.numPrimitives = node->primitives.size();
+        compiled.numChildren = node->children.size();
+        groupNodes.push_back(compiled);
+
+        for (const ScenePrimitive* primitive : node->primitives) {
+            compilePrimitive(*primitive);
+        }
+        for (const SceneNode* child : node->children) {
+            glm::mat4 childMatrix(1);
+            for (const SceneTransformation* transformation : child->transformations) {
+                childMatrix *= transformationToMatrix(*transformation);
+            }
+            addGroupNode(child, childMatrix, depth + 1);
+        }
+    }
+};
+
+// The scene graph of an SDF group, rebuilt from its compiled nodes for CompoundShape
+class GroupBuilder {
+public:
+    GroupBuilder(const CompiledGroupNode* nodes, const CompiledPrimitive* primitives,
+                 const std::vector<const SceneMaterial*>& materials, const std::vector<const AnimationCurve*>& curves):
+        m_nodes(nodes), m_primitives(primitives), m_materials(materials), m_curves(curves) {}
+
+    // The subtree of the node at index, moving index past it. The nodes must have been checked to form whole trees
+    // (see CompiledScene::load).
+    const SceneNode* build(int& index) {
+        const CompiledGroupNode& compiled = m_nodes[index++];
+
+        SceneNode& node = m_sceneNodes.emplace_back();
+        node.transformations.push_back(&m_transformations.emplace_back(
+            SceneTransformation{TransformationType::TRANSFORMATION_MATRIX, {}, {}, {}, 0, compiled.matrix}));
+        if (compiled.hasOperation)
+            node.operation = &m_operations.emplace_back(SceneOperation{compiled.operation, compiled.k, compiled.repeat});
+
+        for (int i = 0; i < compiled.numPrimitives; i++) {
+            node.primitives.push_back(&addPrimitive(m_primitives[compiled.firstPrimitive + i]));
+        }
+        for (int i = 0; i < compiled.numChildren; i++) {
+            node.children.push_back(const_cast<SceneNode*>(build(index)));
+        }
+        return &node;
+    }
+
+private:
+    const CompiledGroupNode* m_nodes;
+    const CompiledPrimitive* m_primitives;
+    const std::vector<const SceneMaterial*>& m_materials;
+    const std::vector<const AnimationCurve*>& m_curves;
+    // Deques, so the nodes' pointers stay valid as they grow
+    std::deque<SceneNode> m_sceneNodes;
+    std::deque<SceneTransformation> m_transformations;
+    std::deque<SceneOperation> m_operations;
+    std::deque<ScenePrimitive> m_scenePrimitives;
+
+    ScenePrimitive& addPrimitive(const CompiledPrimitive& compiled) {
+        ScenePrimitive& primitive = m_scenePrimitives.emplace_back();
+        primitive.type = compiled.type;
+        primitive.fractalType = compiled.fractalType;
+        primitive.material = *m_materials[compiled.material];
+        if (compiled.curve >= 0) {
+            const AnimationCurve* curve = m_curves[compiled.curve];
+            primitive.useBezierCurves = true;
+            primitive.controlPoints.assign(curve->controlPoints, curve->controlPoints + curve->numControlPoints);
+            primitive.movementSpeed = curve->speed;
+        }
+        return primitive;
+    }
+};
+
+}
+
+static RecordSizes currentRecordSizes() {
+    return RecordSizes{sizeof(CompiledSceneHeader), sizeof(SceneLightData), sizeof(CompiledMaterial),
+                       sizeof(CompiledCurve), sizeof(glm::vec3), sizeof(CompiledPrimitive), sizeof(CompiledGroupNode),
+                       sizeof(CompiledShape)};
+}
+
+// Whether a value read from the file is one of the enum's, which run from 0 to last
+template <typename Enum>
+static bool validEnum(Enum value, Enum last) {
+    auto raw = static_cast<std::underlying_type_t<Enum>>(value);
+    return raw >= 0 && raw <= static_cast<std::underlying_type_t<Enum>>(last);
+}
+
+template <typename T>
+static Section appendSection(std::vector<char>& data, const std::vector<T>& items) {
+    data.resize((data.size() + SECTION_ALIGNMENT - 1) / SECTION_ALIGNMENT * SECTION_ALIGNMENT, 0);
+    Section section{data.size(), items.size()};
+    const char* bytes = reinterpret_cast<const char*>(items.data());
+    data.insert(data.end(), bytes, bytes + items.size() * sizeof(T));
+    return section;
+}
+
+// The section's array in the mapped file, or nullptr if it doesn't fit in the file
+template <typename T>
+static const T* sectionData(const uchar* mapped, qint64 size, const Section& section) {
+    if (section.offset % alignof(T) != 0 || section.offset > (std::uint64_t)size
+        || section.count > ((std::uint64_t)size - section.offset) / sizeof(T))
+        return nullptr;
+    return reinterpret_cast<const T*>(mapped + section.offset);
+}
+
+// Writes the scene, with the shapes the compiler was given, to path
+static bool writeCompiled(const std::string& path, const SceneGlobalData& globalData,
+                          const SceneCameraData& cameraData, const std::vector<SceneLightData>& lights,
+                          SceneCompiler& compiler) {
+    if (compiler.groupDepth > MAX_GROUP_DEPTH) {
+        std::cout << "SDF groups nested more than " << MAX_GROUP_DEPTH << " deep can't be compiled" << std::endl;
+        return false;
+    }
+
+    CompiledSceneHeader header{};
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.recordSizes = currentRecordSizes();
+    header.globalData = globalData;
+    header.camera = CompiledCamera{cameraData.pos, cameraData.look, cameraData.up, cameraData.heightAngle,
+                                   cameraData.aperture, cameraData.focalLength, -1, cameraData.useFocusPoint,
+                                   cameraData.focus};
+    if (cameraData.useBezierCurves)
+        header.camera.curve = compiler.addCurve(cameraData.curves, cameraData.speed);
+
+    std::vector<char> data(sizeof(header), 0);
+    header.lights = appendSection(data, lights);
+    header.materials = appendSection(data, compiler.materials);
+    header.curves = appendSection(data, compiler.curves);
+    header.controlPoints = appendSection(data, compiler.controlPoints);
+    header.primitives = appendSection(data, compiler.primitives);
+    header.groupNodes = appendSection(data, compiler.groupNodes);
+    header.shapes = appendSection(data, compiler.shapes);
+    header.strings = appendSection(data, compiler.strings);
+    std::memcpy(data.data(), &header, sizeof(header));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    file.write(data.data(), data.size());
+    return (bool)file;
+}
+
+bool CompiledScene::compile(const std::string& scenePath, const std::string& outputPath) {
+    // The shapes are compiled as the file is read, without building the scene graph first
+    ScenefileReader fileReader = ScenefileReader(scenePath);
+    SceneCompiler compiler;
+    if (!fileReader.streamXML(compiler))
+        return false;
+    return writeCompiled(outputPath, fileReader.getGlobalData(), fileReader.getCameraData(), fileReader.getLights(),
+                         compiler);
+}
+
+bool CompiledScene::write(const std::string& path, const SceneGlobalData& globalData,
+                          const SceneCameraData& cameraData, const std::vector<SceneLightData>& lights,
+                          const SceneNode* root) {
+    SceneCompiler compiler;
+    flattenSceneGraph(root, glm::mat4(1), compiler);
+    return writeCompiled(path, globalData, cameraData, lights, compiler);
+}
+
+bool CompiledScene::isCompiled(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(FILE_MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0;
+}
+
+bool CompiledScene::load(const std::string& path, RenderData& renderData) {
+    QFile file(QString::fromStdString(path));
+    if (!file.open(QIODevice::ReadOnly) || file.size() < (qint64)sizeof(CompiledSceneHeader))
+        return false;
+
+    const uchar* mapped = file.map(0, file.size());
+    if (mapped == nullptr)
+        return false;
+
+    CompiledSceneHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+    RecordSizes recordSizes = currentRecordSizes();
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION
+        || std::memcmp(&header.recordSizes, &recordSizes, sizeof(RecordSizes)) != 0)
+        return false;
+
+    const qint64 size = file.size();
+    const SceneLightData* lights = sectionData<SceneLightData>(mapped, size, header.lights);
+    const CompiledMaterial* materials = sectionData<CompiledMaterial>(mapped, size, header.materials);
+    const CompiledCurve* curves = sectionData<CompiledCurve>(mapped, size, header.curves);
+    const glm::vec3* controlPoints = sectionData<glm::vec3>(mapped, size, header.controlPoints);
+    const CompiledPrimitive* primitives = sectionData<CompiledPrimitive>(mapped, size, header.primitives);
+    const CompiledGroupNode* groupNodes = sectionData<CompiledGroupNode>(mapped, size, header.groupNodes);
+    const CompiledShape* shapes = sectionData<CompiledShape>(mapped, size, header.shapes);
+    const char* strings = sectionData<char>(mapped, size, header.strings);
+    if (!lights || !materials || !curves || !controlPoints || !primitives || !groupNodes || !shapes || !strings)
+        return false;
+
+    // Every index has to land inside its array, and every enum be one of its values, before anything is built from
+    // them
+    auto validFileMap = [&](const CompiledFileMap& fileMap) {
+        return fileMap.filename >= 0 && fileMap.filenameLength >= 0
+               && (std::uint64_t)fileMap.filename + fileMap.filenameLength <= header.strings.count;
+    };
+    for (std::uint64_t i = 0; i < header.materials.count; i++) {
+        if (!validFileMap(materials[i].textureMap) || !validFileMap(materials[i].bumpMap))
+            return false;
+    }
+    for (std::uint64_t i = 0; i < header.curves.count; i++) {
+        if (curves[i].firstPoint < 0 || curves[i].numPoints < 0
+            || (std::uint64_t)curves[i].firstPoint + curves[i].numPoints > header.controlPoints.count)
+            return false;
+    }
+    auto validIndex = [](int index, const Section& section) {
+        return index >= 0 && (std::uint64_t)index < section.count;
+    };
+    auto validCurve = [&](int curve) {
+        return curve == -1 || validIndex(curve, header.curves);
+    };
+    for (std::uint64_t i = 0; i < header.lights.count; i++) {
+        if (!validEnum(lights[i].type, LightType::LIGHT_AREA))
+            return false;
+    }
+    for (std::uint64_t i = 0; i < header.primitives.count; i++) {
+        if (!validIndex(primitives[i].material, header.materials) || !validCurve(primitives[i].curve)
+            || !validEnum(primitives[i].type, PrimitiveType::PRIMITIVE_FRACTAL)
+            || !validEnum(primitives[i].fractalType, FractalType::SERPINSKI))
+            return false;
+    }
+    // The group nodes must be whole trees one after another, each a root followed by its subtree in pre-order,
+    // no deeper than MAX_GROUP_DEPTH. pending holds how many children each node on the path from the current
+    // tree's root still has to come.
+    std::vector<bool> groupRoots(header.groupNodes.count, false);
+    std::vector<int> pending;
+    for (std::uint64_t i = 0; i < header.groupNodes.count; i++) {
+        const CompiledGroupNode& node = groupNodes[i];
+        if (node.numPrimitives < 0 || node.numChildren < 0
+            || (node.hasOperation && !validEnum(node.operation, SDFOperationType::SDF_SUBTRACTION))
+            || (node.numPrimitives > 0 && (node.firstPrimitive < 0
+                                           || (std::uint64_t)node.firstPrimitive + node.numPrimitives
+                                              > header.primitives.count)))
+            return false;
+
+        if (pending.empty())
+            groupRoots[i] = true;
+        else
+            pending.back()--;
+        if (node.numChildren > 0) {
+            if (pending.size() + 2 > MAX_GROUP_DEPTH)
+                return false;
+            pending.push_back(node.numChildren);
+        }
+        while (!pending.empty() && pending.back() == 0) {
+            pending.pop_back();
+        }
+    }
+    if (!pending.empty())
+        return false;
+    for (std::uint64_t i = 0; i < header.shapes.count; i++) {
+        if (shapes[i].primitive == -1 ? !validIndex(shapes[i].group, header.groupNodes) || !groupRoots[shapes[i].group]
+                                      : !validIndex(shapes[i].primitive, header.primitives))
+            return false;
+    }
+    if (!validCurve(header.camera.curve))
+        return false;
+
+    renderData.globalData = header.globalData;
+    SceneCameraData& camera = renderData.cameraData;
+    camera.pos = header.camera.pos;
+    camera.look = header.camera.look;
+    camera.up = header.camera.up;
+    camera.heightAngle = header.camera.heightAngle;
+    camera.aperture = header.camera.aperture;
+    camera.focalLength = header.camera.focalLength;
+    camera.useBezierCurves = header.camera.curve >= 0;
+    camera.curves.clear();
+    if (camera.useBezierCurves) {
+        const CompiledCurve& curve = curves[header.camera.curve];
+        camera.curves.assign(controlPoints + curve.firstPoint, controlPoints + curve.firstPoint + curve.numPoints);
+        camera.speed = curve.speed;
+    }
+    camera.useFocusPoint = header.camera.useFocusPoint;
+    camera.focus = header.camera.focus;
+    renderData.lights.assign(lights, lights + header.lights.count);
+
+    renderData.shapes.clear();
+    renderData.arena = std::make_unique<SceneArena>();
+    SceneArena& arena = *renderData.arena;
+
+    auto fileMap = [&](const CompiledFileMap& compiled) {
+        SceneFileMap fileMap;
+        fileMap.isUsed = compiled.isUsed;
+        fileMap.filename.assign(strings + compiled.filename, compiled.filenameLength);
+        fileMap.repeatU = compiled.repeatU;
+        fileMap.repeatV = compiled.repeatV;
+        return fileMap;
+    };
+    std::vector<const SceneMaterial*> sceneMaterials(header.materials.count);
+    for (std::uint64_t i = 0; i < header.materials.count; i++) {
+        const CompiledMaterial& compiled = materials[i];
+        SceneMaterial material;
+        material.cAmbient = compiled.cAmbient;
+        material.cDiffuse = compiled.cDiffuse;
+        material.cSpecular = compiled.cSpecular;
+        material.cReflective = compiled.cReflective;
+        material.cTransparent = compiled.cTransparent;
+        material.cEmissive = compiled.cEmissive;
+        material.shininess = compiled.shininess;
+        material.ior = compiled.ior;
+        material.blend = compiled.blend;
+        material.textureMap = fileMap(compiled.textureMap);
+        material.bumpMap = fileMap(compiled.bumpMap);
+        material.updateFeatures();
+        sceneMaterials[i] = arena.material(material);
+    }
+
+    std::vector<const AnimationCurve*> sceneCurves(header.curves.count);
+    for (std::uint64_t i = 0; i < header.curves.count; i++) {
+        sceneCurves[i] = arena.curve(controlPoints + curves[i].firstPoint, curves[i].numPoints, curves[i].speed);
+    }
+
+    renderData.shapes.reserve(header.shapes.count);
+    for (std::uint64_t i = 0; i < header.shapes.count; i++) {
+        const CompiledShape& shape = shapes[i];
+        if (shape.primitive == -1) {
+            GroupBuilder builder(groupNodes, primitives, sceneMaterials, sceneCurves);
+            int index = shape.group;
+            const SceneNode* root = builder.build(index);
+            try {
+                renderData.shapes.push_back(arena.create<CompoundShape>(root, shape.ctm, arena));
+            } catch (const std::exception& error) {
+                std::cout << "could not build an SDF group: " << error.what() << std::endl;
+                renderData.shapes.clear();
+                renderData.arena.reset();
+                return false;
+            }
+            continue;
+        }
+
+        const CompiledPrimitive& primitive = primitives[shape.primitive];
+        ShapeData data{sceneMaterials[primitive.material]};
+        if (primitive.curve >= 0)
+            data.curve = sceneCurves[primitive.curve];
+        renderData.shapes.push_back(makeShape(arena, primitive.type, primitive.fractalType, data, shape.ctm));
+    }
+
+    return true;
+}
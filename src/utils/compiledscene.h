@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "scenedata.h"
+
+struct RenderData;
+
+/**
+ * A scene flattened into a binary file that loads without parsing: its lights, camera, materials and animation
+ * curves, and every shape with the final transformation flattening the scene graph gives it, stored as arrays laid
+ * out exactly as they're read. Loading maps the file and builds the shapes straight from the arrays, so startup no
+ * longer grows with the work of parsing and flattening the scene file.
+ *
+ * SDF groups keep their subtree (each node's transformations folded into one matrix), since a group's members are
+ * compiled into its tape when the group is built. Groups nested more than 256 nodes deep can't be compiled. Named objects are expanded into their shapes wherever they're
+ * referred to, rather than kept as shared instances. Files are tied to the format's version and to the size of its
+ * records in the build that wrote them; other files fail to load, and the scene has to be compiled again.
+ */
+class CompiledScene {
+public:
+    // Parses the scene file and writes it compiled to outputPath
+    static bool compile(const std::string& scenePath, const std::string& outputPath);
+    // Writes the scene with the graph under root compiled to path
+    static bool write(const std::string& path, const SceneGlobalData& globalData, const SceneCameraData& cameraData,
+                      const std::vector<SceneLightData>& lights, const SceneNode* root);
+
+    // Whether the file starts like a compiled scene
+    static bool isCompiled(const std::string& path);
+    // Loads a compiled scene into renderData. False if the file can't be read, is from another version, or is corrupt.
+    static bool load(const std::string& path, RenderData& renderData);
+};
@@ -0,0 +1,3 @@
+#include "fractalsettings.h"
+
+FractalSettings fractalSettings;
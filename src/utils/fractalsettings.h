@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+
+/**
+ * @brief The FractalSettings struct controls how much detail is computed when evaluating fractal SDFs.
+ */
+struct FractalSettings {
+    /**
+     * @brief lodEnabled Whether fractals are evaluated with fewer iterations where a pixel is larger than the
+     * detail those iterations would add.
+     */
+    bool lodEnabled = true;
+    /**
+     * @brief lodScale Scales the pixel footprint used to pick iteration budgets (larger is coarser).
+     */
+    float lodScale = 1.0f;
+    /**
+     * @brief mandelbulbIterations The number of iterations used for full detail mandelbulbs.
+     */
+    int mandelbulbIterations = 20;
+    /**
+     * @brief mandelboxIterations The number of iterations used for full detail mandelboxes.
+     */
+    int mandelboxIterations = 30;
+    /**
+     * @brief serpinskiIterations The number of iterations used for full detail serpinski tetrahedrons.
+     */
+    int serpinskiIterations = 15;
+    /**
+     * @brief volumeCacheEnabled Whether fractal SDFs are baked into sparse volumes (and cached on disk) before
+     * rendering, so marching far from the surface uses lookups instead of the full iterative SDF.
+     */
+    bool volumeCacheEnabled = false;
+    /**
+     * @brief volumeCacheDir The directory baked volumes are saved to and loaded from.
+     */
+    std::string volumeCacheDir = "sdfcache";
+    /**
+     * @brief volumeResolution The number of cells along each edge of a baked volume.
+     */
+    int volumeResolution = 256;
+};
+
+extern FractalSettings fractalSettings; // Defined in fractalsettings.cpp
@@ -21,7 +21,7 @@ SDFResult minUnion(std::vector<float>& shapeSDFs, const std::vector<Shape*>& sha
 
 // Return value: first value is smooth min, second value is blend factor
 glm::vec2 smoothPolyMin2(float dist1, float dist2, float smoothFactor, float n) {
-    float h = std::max(smoothFactor - abs(dist1 - dist2), 0.0f) / smoothFactor;
+    float h = std::max(smoothFactor - std::abs(dist1 - dist2), 0.0f) / smoothFactor;
     float m = pow(h, n) * 0.5;
     float s = m * smoothFactor / n;
 
@@ -140,15 +140,39 @@ SDFResult smoothPolyMinMultiple(std::vector<float>& shapeSDFs, const std::vector
 }
 
 SDFResult sceneSDF(glm::vec4 worldSpacePoint, const RayTraceScene& scene) {
-    const std::vector<Shape*>& shapes = scene.getShapes();
+    return sceneSDF(worldSpacePoint, scene.getShapes());
+}
+
+SDFResult sceneSDF(glm::vec4 worldSpacePoint, const std::vector<Shape*>& shapes, float footprint) {
     std::vector<float> shapeSDFs;
 
     for(const Shape* shape : shapes){
         glm::vec4 objectSpacePos = shape->m_ctm_inverse * worldSpacePoint;
-        // NOTE: must scale the distance by the minimum scale factor in the CTM to avoid stepping over the shape
-        shapeSDFs.push_back( shape->shapeSDF( objectSpacePos) * shape->m_minScale );
+        // NOTE: must scale the distance by the step scale (the minimum stretch of the CTM over the SDF's Lipschitz
+        // bound) to avoid stepping over the shape. The footprint goes the other way, shrunk by the largest stretch
+        // so no visible detail is dropped.
+        shapeSDFs.push_back( shape->shapeSDFLod( objectSpacePos, footprint / shape->m_maxScale) * shape->stepScale() );
     }
 
+    return combineSDFs(shapeSDFs, shapes);
+}
+
+SDFResult sceneSDF(glm::vec4 worldSpacePoint, glm::vec4 direction, const std::vector<Shape*>& shapes, float footprint) {
+    // Blending mixes the distances themselves, so they have to be the same in every direction
+    if (rayMarchSettings.smoothMergeEnabled)
+        return sceneSDF(worldSpacePoint, shapes, footprint);
+
+    std::vector<float> shapeSDFs;
+
+    for(const Shape* shape : shapes){
+        glm::vec4 objectSpacePos = shape->m_ctm_inverse * worldSpacePoint;
+        shapeSDFs.push_back( shape->shapeSDFLod( objectSpacePos, footprint / shape->m_maxScale) * shape->stepScale(direction) );
+    }
+
+    return combineSDFs(shapeSDFs, shapes);
+}
+
+SDFResult combineSDFs(std::vector<float>& shapeSDFs, const std::vector<Shape*>& shapes) {
     if (rayMarchSettings.smoothMergeEnabled) {
         if (rayMarchSettings.multipleMerge) {
             return smoothPolyMinMultiple(shapeSDFs, shapes);
@@ -161,16 +185,38 @@ SDFResult sceneSDF(glm::vec4 worldSpacePoint, const RayTraceScene& scene) {
 }
 
 glm::vec3 worldSpaceNormal(glm::vec4 worldSpacePoint, const RayTraceScene& scene) {
+    return worldSpaceNormal(worldSpacePoint, scene.getShapes());
+}
+
+glm::vec3 worldSpaceNormal(glm::vec4 worldSpacePoint, const std::vector<Shape*>& shapes, float footprint) {
     const float smallStep = 0.01;
+    const int NUM_TAPS = 6;
+    const glm::vec4 offsets[NUM_TAPS] = {
+        glm::vec4(smallStep, 0.0f, 0.0f, 0.0f), glm::vec4(-smallStep, 0.0f, 0.0f, 0.0f),
+        glm::vec4(0.0f, smallStep, 0.0f, 0.0f), glm::vec4(0.0f, -smallStep, 0.0f, 0.0f),
+        glm::vec4(0.0f, 0.0f, smallStep, 0.0f), glm::vec4(0.0f, 0.0f, -smallStep, 0.0f),
+    };
+
+    // Evaluate all six taps of a shape in one batch, so expensive SDFs can do them together
+    std::vector<float> tapSDFs[NUM_TAPS];
+    for (const Shape* shape : shapes) {
+        glm::vec4 objectSpaceTaps[NUM_TAPS];
+        float distances[NUM_TAPS];
+        for (int tap = 0; tap < NUM_TAPS; tap++) {
+            objectSpaceTaps[tap] = shape->m_ctm_inverse * (worldSpacePoint + offsets[tap]);
+        }
+        shape->shapeSDFBatch(objectSpaceTaps, distances, NUM_TAPS, footprint / shape->m_maxScale);
+        for (int tap = 0; tap < NUM_TAPS; tap++) {
+            tapSDFs[tap].push_back(distances[tap] * shape->stepScale());
+        }
+    }
 
-    float gradient_x = sceneSDF(worldSpacePoint + glm::vec4(smallStep, 0.0f, 0.0f, 0.0f), scene).sceneSDFVal
-            - sceneSDF(worldSpacePoint - glm::vec4(smallStep, 0.0f, 0.0f, 0.0f), scene).sceneSDFVal;
-    float gradient_y = sceneSDF(worldSpacePoint + glm::vec4(0.0f, smallStep, 0.0f, 0.0f), scene).sceneSDFVal
-            - sceneSDF(worldSpacePoint - glm::vec4(0.0f, smallStep, 0.0f, 0.0f), scene).sceneSDFVal;
-    float gradient_z = sceneSDF(worldSpacePoint + glm::vec4(0.0f, 0.0f, smallStep, 0.0f), scene).sceneSDFVal
-            - sceneSDF(worldSpacePoint - glm::vec4(0.0f, 0.0f, smallStep, 0.0f), scene).sceneSDFVal;
+    float values[NUM_TAPS];
+    for (int tap = 0; tap < NUM_TAPS; tap++) {
+        values[tap] = combineSDFs(tapSDFs[tap], shapes).sceneSDFVal;
+    }
 
-    glm::vec3 normal = glm::vec3(gradient_x, gradient_y, gradient_z);
+    glm::vec3 normal = glm::vec3(values[0] - values[1], values[2] - values[3], values[4] - values[5]);
 
     return glm::normalize(normal);
 }
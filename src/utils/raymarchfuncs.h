@@ -6,4 +6,15 @@ struct SDFResult {
 };
 
 SDFResult sceneSDF(glm::vec4 worldSpacePoint, const RayTraceScene& scene);
+// Same as above, but only considers the given subset of the scene's shapes, resolving detail down to
+// footprint world units (0 for full detail)
+SDFResult sceneSDF(glm::vec4 worldSpacePoint, const std::vector<Shape*>& shapes, float footprint = 0.0f);
+// Same as above, but the distance is only a safe step along the world space direction (in units of direction),
+// which can be much further for stretched shapes. Falls back to the plain distance when smooth merging.
+SDFResult sceneSDF(glm::vec4 worldSpacePoint, glm::vec4 direction, const std::vector<Shape*>& shapes, float footprint);
+// Polynomial smooth min of two distances. Returns the blended distance and the blend factor.
+glm::vec2 smoothPolyMin2(float dist1, float dist2, float smoothFactor, float n);
+// Merges per-shape distances (in the same order as shapes) into the scene distance, according to rayMarchSettings
+SDFResult combineSDFs(std::vector<float>& shapeSDFs, const std::vector<Shape*>& shapes);
 glm::vec3 worldSpaceNormal(glm::vec4 worldSpacePoint, const RayTraceScene& scene);
+glm::vec3 worldSpaceNormal(glm::vec4 worldSpacePoint, const std::vector<Shape*>& shapes, float footprint = 0.0f);
@@ -7,6 +7,8 @@ struct RayMarchSettings {
     float mergeFactor = 0.5f;
     int polyExponent = 2;
     bool multipleMerge = false;
+    bool hybrid = true; // Only march the shapes that need it, intersect the rest in closed form
+    bool temporalReprojection = false; // Start each pixel's march near last frame's hit (animations without super sampling)
 };
 
 extern RayMarchSettings rayMarchSettings; // Defined in raymarchsettings.cpp
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include "scenearena.h"
+#include "raytracer/shape.h"
+
+SceneArena::~SceneArena() {
+    for (Shape* shape : m_shapes) {
+        shape->~Shape();
+    }
+    for (SceneMaterial* material : m_materials) {
+        material->~SceneMaterial();
+    }
+}
+
+void* SceneArena::allocate(std::size_t size, std::size_t alignment) {
+    std::size_t offset = (m_blockUsed + alignment - 1) / alignment * alignment;
+    if (m_blocks.empty() || offset + size > BLOCK_SIZE) {
+        // Anything bigger than a block gets a block of its own
+        m_blocks.push_back(std::make_unique<std::byte[]>(std::max(size, BLOCK_SIZE)));
+        offset = 0;
+    }
+    m_blockUsed = offset + size;
+    m_bytesUsed += size;
+    return m_blocks.back().get() + offset;
+}
+
+static void hashCombine(std::size_t& hash, std::size_t value) {
+    hash ^= value + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+}
+
+static void hashFloats(std::size_t& hash, const float* values, int count) {
+    for (int i = 0; i < count; i++) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        hashCombine(hash, bits);
+    }
+}
+
+static std::size_t hashMaterial(const SceneMaterial& material) {
+    std::size_t hash = 0;
+    for (const SceneColor* color : {&material.cAmbient, &material.cDiffuse, &material.cSpecular,
+                                    &material.cReflective, &material.cTransparent, &material.cEmissive}) {
+        hashFloats(hash, &(*color)[0], 4);
+    }
+    hashFloats(hash, &material.shininess, 1);
+    hashFloats(hash, &material.ior, 1);
+    hashFloats(hash, &material.blend, 1);
+    hashCombine(hash, std::hash<std::string>{}(material.textureMap.filename));
+    hashCombine(hash, std::hash<std::string>{}(material.bumpMap.filename));
+    return hash;
+}
+
+const SceneMaterial* SceneArena::material(const SceneMaterial& material) {
+    std::size_t hash = hashMaterial(material);
+    auto [begin, end] = m_materialsByHash.equal_range(hash);
+    for (auto existing = begin; existing != end; ++existing) {
+        if (*existing->second == material)
+            return existing->second;
+    }
+
+    SceneMaterial* copy = new (allocate(sizeof(SceneMaterial), alignof(SceneMaterial))) SceneMaterial(material);
+    m_materials.push_back(copy);
+    m_materialsByHash.emplace(hash, copy);
+    return copy;
+}
+
+const AnimationCurve* SceneArena::curve(const glm::vec3* controlPoints, int count, float speed) {
+    glm::vec3* points = static_cast<glm::vec3*>(allocate(count * sizeof(glm::vec3), alignof(glm::vec3)));
+    std::copy(controlPoints, controlPoints + count, points);
+    return new (allocate(sizeof(AnimationCurve), alignof(AnimationCurve))) AnimationCurve{points, count, speed};
+}
+
+ShapeData SceneArena::shapeData(const ScenePrimitive& primitive) {
+    ShapeData data{material(primitive.material)};
+    if (primitive.useBezierCurves)
+        data.curve = curve(primitive.controlPoints.data(), primitive.controlPoints.size(), primitive.movementSpeed);
+    return data;
+}
+
+int SceneArena::numShapes() const {
+    return m_shapes.size();
+}
+
+int SceneArena::numMaterials() const {
+    return m_materials.size();
+}
+
+std::size_t SceneArena::bytesUsed() const {
+    return m_bytesUsed;
+}
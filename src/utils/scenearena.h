@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+#include "scenedata.h"
+
+class Shape;
+
+// A bezier curve a shape follows over time, relative to where the scene file puts it
+struct AnimationCurve {
+    const glm::vec3* controlPoints;
+    int numControlPoints;
+    float speed; // Times the curve is run through per unit of time
+};
+
+// What a shape takes from its scene primitive. Both point into the scene's arena, so shapes made of the same
+// material share one copy of it.
+struct ShapeData {
+    const SceneMaterial* material;
+    const AnimationCurve* curve = nullptr; // Only for shapes that follow a bezier curve
+};
+
+/**
+ * Owns the shapes of a parsed scene and everything they share: materials (deduplicated, so shapes with equal
+ * materials point to the same one) and animation curves. They're all placed one after another in large blocks,
+ * so loops over the shapes touch a few contiguous blocks rather than scattered allocations, and they're all freed
+ * together with the arena.
+ */
+class SceneArena {
+public:
+    SceneArena() = default;
+    SceneArena(const SceneArena&) = delete;
+    SceneArena& operator=(const SceneArena&) = delete;
+    ~SceneArena();
+
+    // Constructs a shape in the arena
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        T* shape = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        m_shapes.push_back(shape);
+        return shape;
+    }
+
+    // The arena's copies of the primitive's material and animation curve
+    ShapeData shapeData(const ScenePrimitive& primitive);
+    // The arena's copy of the material, shared with every other shape made of an equal one
+    const SceneMaterial* material(const SceneMaterial& material);
+    // A curve through copies of the count control points
+    const AnimationCurve* curve(const glm::vec3* controlPoints, int count, float speed);
+
+    int numShapes() const;
+    int numMaterials() const;
+    // Bytes taken from the arena's blocks so far
+    std::size_t bytesUsed() const;
+
+private:
+    static constexpr std::size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> m_blocks;
+    std::size_t m_blockUsed = BLOCK_SIZE; // Bytes used in the last block
+    std::size_t m_bytesUsed = 0;
+
+    // Everything with a destructor to run before the blocks are freed
+    std::vector<Shape*> m_shapes;
+    std::vector<SceneMaterial*> m_materials;
+    std::unordered_multimap<std::size_t, const SceneMaterial*> m_materialsByHash;
+
+    void* allocate(std::size_t size, std::size_t alignment);
+};
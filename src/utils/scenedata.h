@@ -66,6 +66,9 @@ struct SceneLightData {
     float angle;         // Only applicable to spot lights, in RADIANS
 
     float width, height; // No longer supported (area lights)
+
+    float softness;      // Only applicable when ray marching. Penumbra width per unit of distance to the occluder
+                         // (0 for hard shadows).
 };
 
 // Struct which contains data for the camera of a scene
@@ -103,6 +106,16 @@ struct SceneFileMap {
        repeatV = 0.0f;
        filename = std::string();
     }
+
+    bool operator==(const SceneFileMap&) const = default;
+};
+
+// Bits for the terms of the lighting model a material actually uses, so shading can leave out the others
+enum MaterialFeature {
+    MATERIAL_SPECULAR    = 1 << 0, // Non-zero cSpecular
+    MATERIAL_TEXTURED    = 1 << 1, // A texture map, blended in
+    MATERIAL_REFLECTIVE  = 1 << 2, // Non-zero cReflective
+    MATERIAL_TRANSPARENT = 1 << 3  // Non-zero cTransparent
 };
 
 // Struct which contains data for a material (e.g. one which might be assigned to an object)
@@ -123,6 +136,22 @@ struct SceneMaterial {
    SceneColor cEmissive;    // Not used
    SceneFileMap bumpMap;    // Not used
 
+   int features = 0;        // MaterialFeature bits, from updateFeatures()
+
+   // Classifies the material by the terms it uses. Must be called again whenever the fields above change.
+   void updateFeatures() {
+       auto isZero = [](const SceneColor& color) { return color.r == 0 && color.g == 0 && color.b == 0; };
+       features = 0;
+       if (!isZero(cSpecular))
+           features |= MATERIAL_SPECULAR;
+       if (textureMap.isUsed && blend != 0)
+           features |= MATERIAL_TEXTURED;
+       if (!isZero(cReflective))
+           features |= MATERIAL_REFLECTIVE;
+       if (!isZero(cTransparent))
+           features |= MATERIAL_TRANSPARENT;
+   }
+
    void clear() {
        cAmbient    = glm::vec4(0);
        cDiffuse    = glm::vec4(0);
@@ -139,7 +168,11 @@ struct SceneMaterial {
 
        cEmissive = glm::vec4(0);
        bumpMap.clear();
+
+       features = 0;
    }
+
+   bool operator==(const SceneMaterial&) const = default;
 };
 
 // Struct which contains data for a single primitive in a scene
@@ -165,10 +198,27 @@ struct SceneTransformation {
     glm::mat4 matrix;    // Only applicable when transforming by a custom matrix. This is that custom matrix.
 };
 
+// Enum of the ways an SDF group combines the distances of its members (ray marching only)
+enum class SDFOperationType {
+    SDF_UNION,
+    SDF_SMOOTH_UNION,
+    SDF_INTERSECTION,
+    SDF_SUBTRACTION // The first member minus all the others
+};
+
+// Struct which contains data for an SDF group: a node whose subtree is ray marched as a single shape.
+struct SceneOperation {
+    SDFOperationType type = SDFOperationType::SDF_UNION;
+    float k = 0.0f;                 // Only applicable to smooth unions. The blend distance, in the node's space.
+    glm::vec3 repeat = glm::vec3(0); // Period of domain repetition along each axis (0 for no repetition)
+};
+
 // Struct which represents a node in the scene graph/tree, to be parsed by the student's `SceneParser`.
 struct SceneNode {
    std::vector<SceneTransformation*> transformations; // Note the order of transformations described in lab 5
    std::vector<ScenePrimitive*>      primitives;
    std::vector<SceneNode*>           children;
+   SceneOperation*                   operation = nullptr; // Non-null if this node is an SDF group
+   bool                              master = false; // A named object other than the root, which blocks refer to
 };
 
@@ -10,6 +10,8 @@
 
 #include <QFile>
 
+#include "sceneparser.h"
+
 #define ERROR_AT(e) "error at line " << e.lineNumber() << " col " << e.columnNumber() << ": "
 #define PARSE_ERROR(e) std::cout << ERROR_AT(e) << "could not parse <" << e.tagName().toStdString() \
    << ">" << std::endl
@@ -18,6 +20,68 @@
 
 // Students, please ignore this file.
 
+/**
+* A start element of the scene file, with its attributes and position. The file is read as a stream, so this is
+* taken from the reader while it's at the element's start tag, for the element's handler to use after reading on.
+*/
+class XmlElement {
+public:
+   explicit XmlElement(const QXmlStreamReader &xml) :
+       m_tagName(xml.name().toString()),
+       m_attributes(xml.attributes()),
+       m_lineNumber(xml.lineNumber()),
+       m_columnNumber(xml.columnNumber()) {}
+
+   QString tagName() const { return m_tagName; }
+   bool hasAttribute(const QString &name) const { return m_attributes.hasAttribute(name); }
+   QString attribute(const QString &name) const { return m_attributes.value(name).toString(); }
+   qint64 lineNumber() const { return m_lineNumber; }
+   qint64 columnNumber() const { return m_columnNumber; }
+
+private:
+   QString m_tagName;
+   QXmlStreamAttributes m_attributes;
+   qint64 m_lineNumber;
+   qint64 m_columnNumber;
+};
+
+static void deleteNode(SceneNode* node) {
+   for (size_t i = 0; i < node->transformations.size(); i++) {
+       delete node->transformations[i];
+   }
+   for (size_t i = 0; i < node->primitives.size(); i++) {
+       delete node->primitives[i];
+   }
+   delete node->operation;
+   delete node;
+}
+
+void flattenSceneGraph(const SceneNode* node, glm::mat4 ctm, SceneSink& sink) {
+   for (const SceneTransformation* transformation : node->transformations) {
+       ctm *= transformationToMatrix(*transformation);
+   }
+
+   // SDF groups become a single shape, built from the whole subtree
+   if (node->operation != nullptr) {
+       sink.addGroup(node, ctm);
+       return;
+   }
+
+   for (const ScenePrimitive* primitive : node->primitives) {
+       sink.addPrimitive(*primitive, ctm);
+   }
+   for (const SceneNode* child : node->children) {
+       if (child->master)
+           sink.addInstance(child, ctm);
+       else
+           flattenSceneGraph(child, ctm, sink);
+   }
+}
+
+void SceneSink::addInstance(const SceneNode* object, glm::mat4 ctm) {
+   flattenSceneGraph(object, ctm, *this);
+}
+
 ScenefileReader::ScenefileReader(const std::string& name)
 {
    file_name = name;
@@ -37,20 +101,7 @@ ScenefileReader::~ScenefileReader()
    }
 
    // Delete all Scene Nodes
-   for (unsigned int node = 0; node < m_nodes.size(); node++) {
-       for (size_t i = 0; i < (m_nodes[node])->transformations.size(); i++) {
-           delete (m_nodes[node])->transformations[i];
-       }
-       for (size_t i = 0; i < (m_nodes[node])->primitives.size(); i++) {
-           delete (m_nodes[node])->primitives[i];
-       }
-       (m_nodes[node])->transformations.clear();
-       (m_nodes[node])->primitives.clear();
-       (m_nodes[node])->children.clear();
-       delete m_nodes[node];
-   }
-
-   m_nodes.clear();
+   deleteNodes(0);
    m_lights.clear();
    m_objects.clear();
 }
@@ -80,6 +131,18 @@ SceneNode* ScenefileReader::getRootNode() const {
    return m_objects["root"];
 }
 
+void ScenefileReader::deleteNodes(size_t firstNode) {
+   for (size_t node = firstNode; node < m_nodes.size(); node++) {
+       deleteNode(m_nodes[node]);
+   }
+   m_nodes.resize(firstNode);
+}
+
+void ScenefileReader::finishElement() {
+   if (m_xml.isStartElement())
+       m_xml.skipCurrentElement();
+}
+
 // This is where it all goes down...
 bool ScenefileReader::readXML() {
    // Read the file
@@ -89,21 +152,44 @@ bool ScenefileReader::readXML() {
        return false;
    }
 
-   // Load the XML document
-   QDomDocument doc;
-   QString errorMessage;
-   int errorLine, errorColumn;
-   if (!doc.setContent(&file, &errorMessage, &errorLine, &errorColumn)) {
-       std::cout << "parse error at line " << errorLine << " col " << errorColumn << ": "
-            << errorMessage.toStdString() << std::endl;
-       return false;
+   // Elements are handled as the reader reaches them, without loading the whole document first
+   m_xml.setDevice(&file);
+   bool success = parseScenefile();
+   if (m_xml.hasError()) {
+       std::cout << "parse error at line " << m_xml.lineNumber() << " col " << m_xml.columnNumber() << ": "
+            << m_xml.errorString().toStdString() << std::endl;
+       success = false;
    }
+   m_xml.setDevice(nullptr);
    file.close();
 
+   if (success)
+       std::cout << "Finished reading " << file_name << std::endl;
+   return success;
+}
+
+bool ScenefileReader::streamXML(SceneSink& sink) {
+   // A block that lists a transformation, operation or repeat after its object can't be streamed, as its object
+   // would be placed before all of its transformation is known. Such files are read whole and then flattened.
+   if (!rootBlocksStreamable()) {
+       if (!readXML())
+           return false;
+       if (SceneNode* root = getRootNode())
+           flattenSceneGraph(root, glm::mat4(1), sink);
+       return true;
+   }
+
+   m_sink = &sink;
+   bool success = readXML();
+   m_sink = nullptr;
+   return success;
+}
+
+bool ScenefileReader::parseScenefile() {
    // Get the root element
-   QDomElement scenefile = doc.documentElement();
-   if (scenefile.tagName() != "scenefile") {
-       std::cout << "missing <scenefile>" << std::endl;
+   if (!m_xml.readNextStartElement() || XmlElement(m_xml).tagName() != "scenefile") {
+       if (!m_xml.hasError())
+           std::cout << "missing <scenefile>" << std::endl;
        return false;
    }
 
@@ -119,9 +205,8 @@ bool ScenefileReader::readXML() {
    m_globalData.ks = 0.5f;
 
    // Iterate over child elements
-   QDomNode childNode = scenefile.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
        if (e.tagName() == "globaldata") {
            if (!parseGlobalData(e))
                return false;
@@ -134,14 +219,13 @@ bool ScenefileReader::readXML() {
        } else if (e.tagName() == "object") {
            if (!parseObjectData(e))
                return false;
-       } else if (!e.isNull()) {
+       } else {
            UNSUPPORTED_ELEMENT(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       finishElement();
    }
 
-   std::cout << "Finished reading " << file_name << std::endl;
    return true;
 }
 
@@ -149,7 +233,7 @@ bool ScenefileReader::readXML() {
 * Helper function to parse a single value, the name of which is stored in
 * name.  For example, to parse <length v="0"/>, name would need to be "v".
 */
-bool parseInt(const QDomElement &single, int &a, const char *name) {
+bool parseInt(const XmlElement &single, int &a, const char *name) {
    if (!single.hasAttribute(name))
        return false;
    a = single.attribute(name).toInt();
@@ -160,7 +244,7 @@ bool parseInt(const QDomElement &single, int &a, const char *name) {
 * Helper function to parse a single value, the name of which is stored in
 * name.  For example, to parse <length v="0"/>, name would need to be "v".
 */
-template <typename T> bool parseSingle(const QDomElement &single, T &a, const QString &str) {
+template <typename T> bool parseSingle(const XmlElement &single, T &a, const QString &str) {
    if (!single.hasAttribute(str))
        return false;
    a = single.attribute(str).toDouble();
@@ -173,7 +257,7 @@ template <typename T> bool parseSingle(const QDomElement &single, T &a, const QS
 * <pos x="0" y="0" z="0"/>, chars would need to be "xyz".
 */
 template <typename T> bool parseTriple(
-       const QDomElement &triple,
+       const XmlElement &triple,
        T &a,
        T &b,
        T &c,
@@ -196,7 +280,7 @@ template <typename T> bool parseTriple(
 * <color r="0" g="0" b="0" a="0"/>, chars would need to be "rgba".
 */
 template <typename T> bool parseQuadruple(
-       const QDomElement &quadruple,
+       const XmlElement &quadruple,
        T &a,
        T &b,
        T &c,
@@ -230,14 +314,13 @@ template <typename T> bool parseQuadruple(
 *   <row a="0" b="0" c="0" d="1"/>
 * </matrix>
 */
-bool parseMatrix(const QDomElement &matrix, glm::mat4 &m) {
+bool parseMatrix(QXmlStreamReader &xml, glm::mat4 &m) {
    float *valuePtr = glm::value_ptr(m);
-   QDomNode childNode = matrix.firstChild();
    int col = 0;
 
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.isElement()) {
+   while (xml.readNextStartElement()) {
+       XmlElement e(xml);
+       if (col < 4) {
            float a, b, c, d;
            if (!parseQuadruple(e, a, b, c, d, "a", "b", "c", "d")
                    && !parseQuadruple(e, a, b, c, d, "v1", "v2", "v3", "v4")) {
@@ -248,9 +331,9 @@ bool parseMatrix(const QDomElement &matrix, glm::mat4 &m) {
            valuePtr[1*4 + col] = b;
            valuePtr[2*4 + col] = c;
            valuePtr[3*4 + col] = d;
-           if (++col == 4) break;
+           col++;
        }
-       childNode = childNode.nextSibling();
+       xml.skipCurrentElement();
    }
 
    return (col == 4);
@@ -260,7 +343,7 @@ bool parseMatrix(const QDomElement &matrix, glm::mat4 &m) {
 * Helper function to parse a color.  Will parse an element with r, g, b, and
 * a attributes (the a attribute is optional and defaults to 1).
 */
-bool parseColor(const QDomElement &color, SceneColor &c) {
+bool parseColor(const XmlElement &color, SceneColor &c) {
    c.a = 1;
    return parseQuadruple(color, c.r, c.g, c.b, c.a, "r", "g", "b", "a") ||
           parseQuadruple(color, c.r, c.g, c.b, c.a, "x", "y", "z", "w") ||
@@ -273,7 +356,7 @@ bool parseColor(const QDomElement &color, SceneColor &c) {
 * scenefile root. Example texture map tag:
 * <texture file="/image/andyVanDam.jpg" u="1" v="1"/>
 */
-bool parseMap(const QDomElement &e, SceneFileMap &map, const std::filesystem::path &basepath) {
+bool parseMap(const XmlElement &e, SceneFileMap &map, const std::filesystem::path &basepath) {
    if (!e.hasAttribute("file"))
        return false;
 
@@ -289,11 +372,10 @@ bool parseMap(const QDomElement &e, SceneFileMap &map, const std::filesystem::pa
 /**
 * Parse a <globaldata> tag and fill in m_globalData.
 */
-bool ScenefileReader::parseGlobalData(const QDomElement &globaldata) {
+bool ScenefileReader::parseGlobalData(const XmlElement &globaldata) {
    // Iterate over child elements
-   QDomNode childNode = globaldata.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
        if (e.tagName() == "ambientcoeff") {
            if (!parseSingle(e, m_globalData.ka, "v")) {
                PARSE_ERROR(e);
@@ -315,7 +397,7 @@ bool ScenefileReader::parseGlobalData(const QDomElement &globaldata) {
                return false;
            }
        }
-       childNode = childNode.nextSibling();
+       finishElement();
    }
 
    return true;
@@ -324,7 +406,7 @@ bool ScenefileReader::parseGlobalData(const QDomElement &globaldata) {
 /**
 * Parse a <lightdata> tag and add a new CS123SceneLightData to m_lights.
 */
-bool ScenefileReader::parseLightData(const QDomElement &lightdata) {
+bool ScenefileReader::parseLightData(const XmlElement &lightdata) {
    // Create a default light
    SceneLightData* light = new SceneLightData();
    m_lights.push_back(light);
@@ -335,9 +417,8 @@ bool ScenefileReader::parseLightData(const QDomElement &lightdata) {
    light->function = glm::vec3(1, 0, 0);
 
    // Iterate over child elements
-   QDomNode childNode = lightdata.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
        if (e.tagName() == "id") {
            if (!parseInt(e, light->id, "v")) {
                PARSE_ERROR(e);
@@ -428,11 +509,16 @@ bool ScenefileReader::parseLightData(const QDomElement &lightdata) {
                PARSE_ERROR(e);
                return false;
            }
-       } else if (!e.isNull()) {
+       } else if (e.tagName() == "softness") {
+           if (!parseSingle(e, light->softness, "v") || light->softness < 0) {
+               PARSE_ERROR(e);
+               return false;
+           }
+       } else {
            UNSUPPORTED_ELEMENT(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       finishElement();
    }
 
    return true;
@@ -441,14 +527,13 @@ bool ScenefileReader::parseLightData(const QDomElement &lightdata) {
 /**
 * Parse a <cameradata> tag and fill in m_cameraData.
 */
-bool ScenefileReader::parseCameraData(const QDomElement &cameradata) {
+bool ScenefileReader::parseCameraData(const XmlElement &cameradata) {
    bool focusFound = false;
    bool lookFound = false;
 
    // Iterate over child elements
-   QDomNode childNode = cameradata.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
        if (e.tagName() == "pos") {
            if (!parseTriple(e, m_cameraData.pos.x, m_cameraData.pos.y, m_cameraData.pos.z, "x", "y", "z")) {
                PARSE_ERROR(e);
@@ -509,11 +594,11 @@ bool ScenefileReader::parseCameraData(const QDomElement &cameradata) {
                PARSE_ERROR(e);
                return false;
            }
-       } else if (!e.isNull()) {
+       } else {
            UNSUPPORTED_ELEMENT(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       finishElement();
    }
 
    if (focusFound && lookFound) {
@@ -533,7 +618,7 @@ bool ScenefileReader::parseCameraData(const QDomElement &cameradata) {
 /**
 * Parse an <object> tag and create a new CS123SceneNode in m_nodes.
 */
-bool ScenefileReader::parseObjectData(const QDomElement &object) {
+bool ScenefileReader::parseObjectData(const XmlElement &object) {
    if (!object.hasAttribute("name")) {
        PARSE_ERROR(object);
        return false;
@@ -554,14 +639,22 @@ bool ScenefileReader::parseObjectData(const QDomElement &object) {
 
    // Create the object and add to the map
    SceneNode *node = new SceneNode;
+   node->master = name != "root";
    m_nodes.push_back(node);
    m_objects[name] = node;
 
+   // When streaming, the root's blocks go straight to the sink instead of into its node
+   bool stream = m_sink != nullptr && name == "root";
+
    // Iterate over child elements
-   QDomNode childNode = object.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "transblock") {
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
+       if (e.tagName() == "transblock" && stream) {
+           if (!streamTransBlock(e, glm::mat4(1))) {
+               PARSE_ERROR(e);
+               return false;
+           }
+       } else if (e.tagName() == "transblock") {
            SceneNode *child = new SceneNode;
            m_nodes.push_back(child);
            if (!parseTransBlock(e, child)) {
@@ -569,16 +662,21 @@ bool ScenefileReader::parseObjectData(const QDomElement &object) {
                return false;
            }
            node->children.push_back(child);
-       } else if (!e.isNull()) {
+       } else {
            UNSUPPORTED_ELEMENT(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       finishElement();
    }
 
    return true;
 }
 
+static bool isTransformation(const XmlElement &e) {
+   return e.tagName() == "translate" || e.tagName() == "rotate" || e.tagName() == "scale"
+          || e.tagName() == "matrix";
+}
+
 /**
 * Parse a <transblock> tag into node, which consists of any number of
 * <translate>, <rotate>, <scale>, or <matrix> elements followed by one
@@ -592,131 +690,302 @@ bool ScenefileReader::parseObjectData(const QDomElement &object) {
 *   <scale x="1" y="2" z="1"/>
 *   <object type="primitive" name="sphere"/>
 * </transblock>
+*
+* A transblock may also contain <operation> and <repeat> elements, which make it an SDF group
+* (see parseOperation).
 */
-bool ScenefileReader::parseTransBlock(const QDomElement &transblock, SceneNode* node) {
+bool ScenefileReader::parseTransBlock(const XmlElement &transblock, SceneNode* node) {
    // Iterate over child elements
-   QDomNode childNode = transblock.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
-       if (e.tagName() == "translate") {
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
+       if (isTransformation(e)) {
            SceneTransformation *t = new SceneTransformation();
            node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_TRANSLATE;
 
-           if (!parseTriple(e, t->translate.x, t->translate.y, t->translate.z, "x", "y", "z")) {
+           if (!parseTransformation(e, *t)) {
                PARSE_ERROR(e);
                return false;
            }
-       } else if (e.tagName() == "rotate") {
-           SceneTransformation *t = new SceneTransformation();
-           node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_ROTATE;
-
-           float angle;
-           if (!parseQuadruple(e, t->rotate.x, t->rotate.y, t->rotate.z, angle, "x", "y", "z", "angle")) {
+       } else if (e.tagName() == "operation" || e.tagName() == "repeat") {
+           if (!parseOperation(e, node)) {
                PARSE_ERROR(e);
                return false;
            }
+       } else if (e.tagName() == "object") {
+           if (e.attribute("type") == "master") {
+               std::string masterName = e.attribute("name").toStdString();
+               if (!m_objects[masterName]) {
+                   std::cout << ERROR_AT(e) << "invalid master object reference: " << masterName << std::endl;
+                   return false;
+               }
+               node->children.push_back(m_objects[masterName]);
+           } else if (e.attribute("type") == "tree") {
+               while (m_xml.readNextStartElement()) {
+                   XmlElement e(m_xml);
+                   if (e.tagName() == "transblock") {
+                       SceneNode* n = new SceneNode;
+                       m_nodes.push_back(n);
+                       node->children.push_back(n);
+                       if (!parseTransBlock(e, n)) {
+                           PARSE_ERROR(e);
+                           return false;
+                       }
+                   } else {
+                       UNSUPPORTED_ELEMENT(e);
+                       return false;
+                   }
+                   finishElement();
+               }
+           } else if (e.attribute("type") == "primitive") {
+               ScenePrimitive* primitive = new ScenePrimitive();
+               node->primitives.push_back(primitive);
+               if (!parsePrimitive(e, *primitive)) {
+                   PARSE_ERROR(e);
+                   return false;
+               }
+           } else {
+               std::cout << ERROR_AT(e) << "invalid object type: " << e.attribute("type").toStdString() << std::endl;
+               return false;
+           }
+       } else {
+           UNSUPPORTED_ELEMENT(e);
+           return false;
+       }
+       finishElement();
+   }
 
-           // Convert to radians
-           t->angle = angle * M_PI / 180;
-       } else if (e.tagName() == "scale") {
-           SceneTransformation *t = new SceneTransformation();
-           node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_SCALE;
+   return true;
+}
 
-           if (!parseTriple(e, t->scale.x, t->scale.y, t->scale.z, "x", "y", "z")) {
+/**
+* Parse a <translate>, <rotate>, <scale>, or <matrix> tag into t.
+*/
+bool ScenefileReader::parseTransformation(const XmlElement &transformation, SceneTransformation &t) {
+   if (transformation.tagName() == "translate") {
+       t.type = TransformationType::TRANSFORMATION_TRANSLATE;
+       return parseTriple(transformation, t.translate.x, t.translate.y, t.translate.z, "x", "y", "z");
+   } else if (transformation.tagName() == "rotate") {
+       t.type = TransformationType::TRANSFORMATION_ROTATE;
+
+       float angle;
+       if (!parseQuadruple(transformation, t.rotate.x, t.rotate.y, t.rotate.z, angle, "x", "y", "z", "angle"))
+           return false;
+
+       // Convert to radians
+       t.angle = angle * M_PI / 180;
+       return true;
+   } else if (transformation.tagName() == "scale") {
+       t.type = TransformationType::TRANSFORMATION_SCALE;
+       return parseTriple(transformation, t.scale.x, t.scale.y, t.scale.z, "x", "y", "z");
+   } else {
+       t.type = TransformationType::TRANSFORMATION_MATRIX;
+       return parseMatrix(m_xml, t.matrix);
+   }
+}
+
+/**
+* Read a <transblock> of the root object straight into the sink, giving it the same shapes as parsing
+* the block into a node and flattening it would. ctm is the cumulative transformation of the enclosing
+* block. Nothing of the block is kept once it's read, except for SDF groups: the rest of a block with
+* an <operation> or <repeat> is parsed into a node as usual (the group needs its whole subtree), handed
+* to the sink as one group, and then freed.
+*/
+bool ScenefileReader::streamTransBlock(const XmlElement &transblock, glm::mat4 ctm) {
+   bool objectRead = false;
+
+   // Iterate over child elements
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
+       bool isOperation = e.tagName() == "operation" || e.tagName() == "repeat";
+       if ((isTransformation(e) || isOperation) && objectRead) {
+           std::cout << ERROR_AT(e) << "<" << e.tagName().toStdString()
+                     << "> must come before the transblock's object" << std::endl;
+           return false;
+       }
+
+       if (isTransformation(e)) {
+           SceneTransformation t;
+           if (!parseTransformation(e, t)) {
                PARSE_ERROR(e);
                return false;
            }
-       } else if (e.tagName() == "matrix") {
-           SceneTransformation* t = new SceneTransformation();
-           node->transformations.push_back(t);
-           t->type = TransformationType::TRANSFORMATION_MATRIX;
-
-           if (!parseMatrix(e, t->matrix)) {
+           ctm *= transformationToMatrix(t);
+       } else if (isOperation) {
+           size_t firstNode = m_nodes.size();
+           SceneNode* group = new SceneNode;
+           m_nodes.push_back(group);
+           if (!parseOperation(e, group)) {
                PARSE_ERROR(e);
                return false;
            }
+           finishElement();
+           if (!parseTransBlock(transblock, group))
+               return false;
+
+           for (const SceneTransformation* t : group->transformations) {
+               ctm *= transformationToMatrix(*t);
+           }
+           m_sink->addGroup(group, ctm);
+           deleteNodes(firstNode);
+           return true;
        } else if (e.tagName() == "object") {
+           objectRead = true;
            if (e.attribute("type") == "master") {
                std::string masterName = e.attribute("name").toStdString();
                if (!m_objects[masterName]) {
                    std::cout << ERROR_AT(e) << "invalid master object reference: " << masterName << std::endl;
                    return false;
                }
-               node->children.push_back(m_objects[masterName]);
+               m_sink->addInstance(m_objects[masterName], ctm);
            } else if (e.attribute("type") == "tree") {
-               QDomNode subNode = e.firstChild();
-               while (!subNode.isNull()) {
-                   QDomElement e = subNode.toElement();
+               while (m_xml.readNextStartElement()) {
+                   XmlElement e(m_xml);
                    if (e.tagName() == "transblock") {
-                       SceneNode* n = new SceneNode;
-                       m_nodes.push_back(n);
-                       node->children.push_back(n);
-                       if (!parseTransBlock(e, n)) {
+                       if (!streamTransBlock(e, ctm)) {
                            PARSE_ERROR(e);
                            return false;
                        }
-                   } else if (!e.isNull()) {
+                   } else {
                        UNSUPPORTED_ELEMENT(e);
                        return false;
                    }
-                   subNode = subNode.nextSibling();
+                   finishElement();
                }
            } else if (e.attribute("type") == "primitive") {
-               if (!parsePrimitive(e, node)) {
+               ScenePrimitive primitive;
+               if (!parsePrimitive(e, primitive)) {
                    PARSE_ERROR(e);
                    return false;
                }
+               m_sink->addPrimitive(primitive, ctm);
            } else {
                std::cout << ERROR_AT(e) << "invalid object type: " << e.attribute("type").toStdString() << std::endl;
                return false;
            }
-       } else if (!e.isNull()) {
+       } else {
            UNSUPPORTED_ELEMENT(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       finishElement();
+   }
+
+   return true;
+}
+
+// Whether every block under the reader's current element lists its object after its transformations, operation
+// and repeat
+static bool objectsComeLast(QXmlStreamReader &xml) {
+   bool objectRead = false;
+   while (xml.readNextStartElement()) {
+       XmlElement e(xml);
+       if (e.tagName() == "transblock" || (e.tagName() == "object" && e.attribute("type") == "tree")) {
+           if (!objectsComeLast(xml))
+               return false;
+       } else if (isTransformation(e) || e.tagName() == "operation" || e.tagName() == "repeat") {
+           if (objectRead)
+               return false;
+           xml.skipCurrentElement();
+       } else {
+           xml.skipCurrentElement();
+       }
+       objectRead = objectRead || e.tagName() == "object";
+   }
+   return true;
+}
+
+/**
+* Skim the file for blocks of the root object that list a transformation, operation or repeat after their
+* object, which streamTransBlock can't place. Nothing is kept; errors in the file are left for readXML to report.
+*/
+bool ScenefileReader::rootBlocksStreamable() const {
+   QFile file(file_name.c_str());
+   if (!file.open(QFile::ReadOnly))
+       return true;
+
+   QXmlStreamReader xml(&file);
+   if (!xml.readNextStartElement())
+       return true;
+   while (xml.readNextStartElement()) {
+       XmlElement e(xml);
+       if (e.tagName() == "object" && e.attribute("name") == "root")
+           return objectsComeLast(xml);
+       xml.skipCurrentElement();
+   }
+   return true;
+}
+
+/**
+* Parse an <operation> or <repeat> tag into node, making it an SDF group. When ray marching, all the
+* primitives under the group are combined with the given operation and marched as a single shape.
+* Example:
+*
+* <transblock>
+*   <operation v="smoothunion" k="0.3"/>
+*   <repeat x="2" y="0" z="2"/>
+*   <transblock> ... </transblock>
+*   <transblock> ... </transblock>
+* </transblock>
+*
+* v is one of union, smoothunion, intersection or subtraction (the first member minus the rest). Repeat
+* periods of 0 leave that axis unrepeated.
+*/
+bool ScenefileReader::parseOperation(const XmlElement &operation, SceneNode* node) {
+   if (node->operation == nullptr)
+       node->operation = new SceneOperation();
+   SceneOperation* op = node->operation;
+
+   if (operation.tagName() == "repeat")
+       return parseTriple(operation, op->repeat.x, op->repeat.y, op->repeat.z, "x", "y", "z");
+
+   std::string type = operation.attribute("v").toStdString();
+   if (type == "union") op->type = SDFOperationType::SDF_UNION;
+   else if (type == "smoothunion") op->type = SDFOperationType::SDF_SMOOTH_UNION;
+   else if (type == "intersection") op->type = SDFOperationType::SDF_INTERSECTION;
+   else if (type == "subtraction") op->type = SDFOperationType::SDF_SUBTRACTION;
+   else {
+       std::cout << ERROR_AT(operation) << "invalid operation: " << type << std::endl;
+       return false;
    }
 
+   if (op->type == SDFOperationType::SDF_SMOOTH_UNION && !parseSingle(operation, op->k, "k")) {
+       std::cout << ERROR_AT(operation) << "smoothunion requires a blend distance k" << std::endl;
+       return false;
+   }
    return true;
 }
 
 /**
-* Parse an <object type="primitive"> tag into node.
+* Parse an <object type="primitive"> tag into primitive.
 */
-bool ScenefileReader::parsePrimitive(const QDomElement &prim, SceneNode* node) {
+bool ScenefileReader::parsePrimitive(const XmlElement &prim, ScenePrimitive &primitive) {
    // Default primitive
-   ScenePrimitive* primitive = new ScenePrimitive();
-   primitive->controlPoints.push_back(glm::vec3(0,0,0)); // insert initial null translation (so that position along relative bezier curve begins at the default shape pos)
-   SceneMaterial& mat = primitive->material;
+   primitive.controlPoints.push_back(glm::vec3(0,0,0)); // insert initial null translation (so that position along relative bezier curve begins at the default shape pos)
+   SceneMaterial& mat = primitive.material;
    mat.clear();
-   primitive->type = PrimitiveType::PRIMITIVE_CUBE;
+   primitive.type = PrimitiveType::PRIMITIVE_CUBE;
    mat.textureMap.isUsed = false;
    mat.bumpMap.isUsed = false;
    mat.cDiffuse.r = mat.cDiffuse.g = mat.cDiffuse.b = 1;
-   node->primitives.push_back(primitive);
 
    std::filesystem::path basepath = std::filesystem::path(file_name).parent_path().parent_path();
 
    // Parse primitive type
    std::string primType = prim.attribute("name").toStdString();
-   if (primType == "sphere") primitive->type = PrimitiveType::PRIMITIVE_SPHERE;
-   else if (primType == "cube") primitive->type = PrimitiveType::PRIMITIVE_CUBE;
-   else if (primType == "cylinder") primitive->type = PrimitiveType::PRIMITIVE_CYLINDER;
-   else if (primType == "cone") primitive->type = PrimitiveType::PRIMITIVE_CONE;
-   else if (primType == "spherescene") primitive->type = PrimitiveType::SPHERE_SCENE;
-   else if (primType == "fractal") primitive->type = PrimitiveType::PRIMITIVE_FRACTAL;
-   else if (primType == "torus") primitive->type = PrimitiveType::PRIMITIVE_TORUS;
+   if (primType == "sphere") primitive.type = PrimitiveType::PRIMITIVE_SPHERE;
+   else if (primType == "cube") primitive.type = PrimitiveType::PRIMITIVE_CUBE;
+   else if (primType == "cylinder") primitive.type = PrimitiveType::PRIMITIVE_CYLINDER;
+   else if (primType == "cone") primitive.type = PrimitiveType::PRIMITIVE_CONE;
+   else if (primType == "spherescene") primitive.type = PrimitiveType::SPHERE_SCENE;
+   else if (primType == "fractal") primitive.type = PrimitiveType::PRIMITIVE_FRACTAL;
+   else if (primType == "torus") primitive.type = PrimitiveType::PRIMITIVE_TORUS;
    else if (primType == "mesh") {
-       primitive->type = PrimitiveType::PRIMITIVE_MESH;
+       primitive.type = PrimitiveType::PRIMITIVE_MESH;
        if (prim.hasAttribute("meshfile")) {
            std::filesystem::path relativePath(prim.attribute("meshfile").toStdString());
-           primitive->meshfile = (basepath / relativePath).string();
+           primitive.meshfile = (basepath / relativePath).string();
        } else if (prim.hasAttribute("filename")) {
            std::filesystem::path relativePath(prim.attribute("filename").toStdString());
-           primitive->meshfile = (basepath / relativePath).string();
+           primitive.meshfile = (basepath / relativePath).string();
        } else {
            std::cout << "mesh object must specify filename" << std::endl;
            return false;
@@ -724,9 +993,8 @@ bool ScenefileReader::parsePrimitive(const QDomElement &prim, SceneNode* node) {
    }
 
    // Iterate over child elements
-   QDomNode childNode = prim.firstChild();
-   while (!childNode.isNull()) {
-       QDomElement e = childNode.toElement();
+   while (m_xml.readNextStartElement()) {
+       XmlElement e(m_xml);
        if (e.tagName() == "diffuse") {
            if (!parseColor(e, mat.cDiffuse)) {
                PARSE_ERROR(e);
@@ -788,20 +1056,20 @@ bool ScenefileReader::parsePrimitive(const QDomElement &prim, SceneNode* node) {
                PARSE_ERROR(e);
                return false;
            }
-           primitive->useBezierCurves = true;
-           primitive->controlPoints.push_back(p);
+           primitive.useBezierCurves = true;
+           primitive.controlPoints.push_back(p);
        } else if (e.tagName() == "speed") {
-           if (!parseSingle(e, primitive->movementSpeed, "v")) {
+           if (!parseSingle(e, primitive.movementSpeed, "v")) {
                PARSE_ERROR(e);
                return false;
            }
        }  else if (e.tagName() == "fractal"){
           if(e.attribute("v") == "mandelbulb"){
-              primitive->fractalType = FractalType::MANDELBULB;
+              primitive.fractalType = FractalType::MANDELBULB;
           } else if (e.attribute("v") == "mandelbox"){
-              primitive->fractalType = FractalType::MANDELBOX;
+              primitive.fractalType = FractalType::MANDELBOX;
           } else if (e.attribute("v") == "serpinski"){
-              primitive->fractalType = FractalType::SERPINSKI;
+              primitive.fractalType = FractalType::SERPINSKI;
           } else {
               UNSUPPORTED_ELEMENT(e);
           }
@@ -809,8 +1077,9 @@ bool ScenefileReader::parsePrimitive(const QDomElement &prim, SceneNode* node) {
            UNSUPPORTED_ELEMENT(e);
            return false;
        }
-       childNode = childNode.nextSibling();
+       finishElement();
    }
 
+   mat.updateFeatures();
    return true;
 }
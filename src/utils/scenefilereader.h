@@ -5,7 +5,30 @@
 #include <vector>
 #include <map>
 
-#include <QDomDocument>
+#include <glm/glm.hpp>
+#include <QXmlStreamReader>
+
+class XmlElement;
+
+// Receives the flattened shapes of a scene: every primitive with its cumulative transformation, in the order
+// a depth first traversal of the scene graph reaches them
+class SceneSink {
+public:
+    virtual ~SceneSink() = default;
+
+    // A primitive outside of any SDF group
+    virtual void addPrimitive(const ScenePrimitive& primitive, glm::mat4 ctm) = 0;
+    // An SDF group, with its whole subtree. ctm already includes the group node's own transformations. The group
+    // is only valid during the call.
+    virtual void addGroup(const SceneNode* group, glm::mat4 ctm) = 0;
+    // A reference to a named object, which may be shared by many blocks. ctm is the cumulative transformation of
+    // the block referring to it. By default the object is flattened into the sink like the rest of the scene.
+    virtual void addInstance(const SceneNode* object, glm::mat4 ctm);
+};
+
+// Flattens the scene graph under node into the sink. ctm is the cumulative transformation of node's parent.
+// Named objects are handed to the sink as instances.
+void flattenSceneGraph(const SceneNode* node, glm::mat4 ctm, SceneSink& sink);
 
 // This class parses the scene graph specified by the CS123 Xml file format.
 class ScenefileReader {
@@ -19,6 +42,17 @@ public:
     // Parse the XML scene file. Returns false if scene is invalid.
     bool readXML();
 
+    // Parse the XML scene file like readXML, but hand the root object's shapes to the sink as they're read
+    // instead of building its scene graph, so only the transformations of the blocks being read (and any SDF
+    // group being read) are kept. The root node stays empty. Objects other than the root are still kept whole,
+    // since the root can refer to them.
+    //
+    // Blocks of the root object are streamed when they list their transformations, operation and repeat before their
+    // object, as they're applied to everything read after them. If any block doesn't (which the file is skimmed for
+    // first), the file is read whole and the root flattened into the sink instead. Returns false if scene is
+    // invalid; the sink may have been given some of its shapes by then.
+    bool streamXML(SceneSink& sink);
+
     SceneGlobalData getGlobalData() const;
 
     SceneCameraData getCameraData() const;
@@ -30,14 +64,26 @@ public:
 private:
     // The filename should be contained within this parser implementation.
     // If you want to parse a new file, instantiate a different parser.
-    bool parseGlobalData(const QDomElement &globaldata);
-    bool parseCameraData(const QDomElement &cameradata);
-    bool parseLightData(const QDomElement &lightdata);
-    bool parseObjectData(const QDomElement &object);
-    bool parseTransBlock(const QDomElement &transblock, SceneNode* node);
-    bool parsePrimitive(const QDomElement &prim, SceneNode* node);
+    bool parseScenefile();
+    bool parseGlobalData(const XmlElement &globaldata);
+    bool parseCameraData(const XmlElement &cameradata);
+    bool parseLightData(const XmlElement &lightdata);
+    bool parseObjectData(const XmlElement &object);
+    bool parseTransBlock(const XmlElement &transblock, SceneNode* node);
+    bool parseTransformation(const XmlElement &transformation, SceneTransformation &t);
+    bool parsePrimitive(const XmlElement &prim, ScenePrimitive &primitive);
+    bool parseOperation(const XmlElement &operation, SceneNode* node);
+    bool streamTransBlock(const XmlElement &transblock, glm::mat4 ctm);
+    bool rootBlocksStreamable() const;
+
+    // Moves past the rest of the element just handled, unless its handler already read through to its end
+    void finishElement();
+    // Frees the nodes created since there were firstNode of them
+    void deleteNodes(size_t firstNode);
 
     std::string file_name;
+    QXmlStreamReader m_xml;
+    SceneSink* m_sink = nullptr; // Only while streaming
     mutable std::map<std::string, SceneNode*> m_objects;
     SceneGlobalData m_globalData;
     SceneCameraData m_cameraData;
@@ -7,8 +7,12 @@
 #include "shapes/sphere.h"
 #include "shapes/cone.h"
 #include "shapes/spherescene.h"
+#include "shapes/compound.h"
+#include "shapes/instance.h"
+#include "compiledscene.h"
 
 #include <chrono>
+#include <map>
 #include <memory>
 #include <iostream>
 
@@ -26,62 +30,95 @@ glm::mat4 transformationToMatrix(SceneTransformation transformation){
     return glm::mat4(1);
 }
 
-Shape* makeShape(ScenePrimitive& primative, glm::mat4 ctm, float minScale){
-    switch(primative.type){
+Shape* makeShape(SceneArena& arena, PrimitiveType type, FractalType fractalType, ShapeData data, glm::mat4 ctm){
+    switch(type){
         case PrimitiveType::PRIMITIVE_SPHERE:
-            return new Sphere(primative, ctm, minScale);
+            return arena.create<Sphere>(data, ctm);
         case PrimitiveType::PRIMITIVE_CYLINDER:
-            return new Cylinder(primative, ctm, minScale);
+            return arena.create<Cylinder>(data, ctm);
         case PrimitiveType::PRIMITIVE_CUBE:
-            return new Cube(primative, ctm, minScale);
+            return arena.create<Cube>(data, ctm);
         case PrimitiveType::PRIMITIVE_CONE:
-            return new Cone(primative, ctm, minScale);
+            return arena.create<Cone>(data, ctm);
         case PrimitiveType::PRIMITIVE_MESH:
         case PrimitiveType::PRIMITIVE_TORUS:
             throw std::invalid_argument("received unsupported primitive type");
         case PrimitiveType::SPHERE_SCENE:
-            return new SphereScene(primative, ctm, minScale);
+            return arena.create<SphereScene>(data, ctm);
         case PrimitiveType::PRIMITIVE_FRACTAL:
-            return new Fractal(primative, ctm, minScale, primative.fractalType);
+            return arena.create<Fractal>(data, ctm, fractalType);
     }
     return NULL;
 }
 
-void traverseSceneGraph(SceneNode* node, glm::mat4 mParent, std::vector<Shape*>& shapes, float minScale){
-    float currMin = minScale;
-
-    for(int i = 0; i < node->transformations.size(); i++){
-        SceneTransformation transformation = *node->transformations[i];
+Shape* makeShape(SceneArena& arena, const ScenePrimitive& primative, glm::mat4 ctm){
+    return makeShape(arena, primative.type, primative.fractalType, arena.shapeData(primative), ctm);
+}
 
-        if (transformation.type == TransformationType::TRANSFORMATION_SCALE) {
-            currMin = std::min(currMin,
-                               std::min(transformation.scale[0], std::min(transformation.scale[1], transformation.scale[2])));
-        }
+// Makes the shapes of a scene in its arena, as the scene file reader flattens the scene
+class ShapeBuilder : public SceneSink {
+public:
+    ShapeBuilder(std::vector<Shape*>& shapes, SceneArena& arena): m_shapes(shapes), m_arena(arena) {}
 
-        mParent *= transformationToMatrix(transformation);
+    void addPrimitive(const ScenePrimitive& primitive, glm::mat4 ctm) override {
+        m_shapes.emplace_back(makeShape(m_arena, primitive, ctm));
     }
 
-    for(int i = 0; i < node->primitives.size(); i++){
-        Shape* shape;
-
-        if (currMin == std::numeric_limits<float>::infinity()) {
-            shape = makeShape(*node->primitives[i], mParent, 1.0f);
-        } else {
-            shape = makeShape(*node->primitives[i], mParent, currMin);
+    // SDF groups become a single shape, built from the whole subtree. Groups that can't be built fail the parse
+    // once the file has been read.
+    void addGroup(const SceneNode* group, glm::mat4 ctm) override {
+        try {
+            m_shapes.emplace_back(m_arena.create<CompoundShape>(group, ctm, m_arena));
+        } catch (const std::exception& error) {
+            if (m_error.empty())
+                m_error = error.what();
         }
+    }
 
-        shapes.emplace_back(shape);
+    // Every reference to an object shares one prototype of it, built the first time it's referred to. Objects
+    // that can't be shared are flattened as usual.
+    void addInstance(const SceneNode* object, glm::mat4 ctm) override {
+        auto prototype = m_prototypes.find(object);
+        if (prototype == m_prototypes.end())
+            prototype = m_prototypes.emplace(object, InstancePrototype::build(object, m_arena)).first;
+
+        if (prototype->second == nullptr)
+            SceneSink::addInstance(object, ctm);
+        else
+            m_shapes.emplace_back(m_arena.create<InstanceShape>(prototype->second, ctm));
     }
 
-    for(int i = 0; i < node->children.size(); i++){
-        traverseSceneGraph(node->children[i], mParent, shapes, currMin);
+    // Why the first group that couldn't be built failed, or empty if they all were
+    const std::string& error() const {
+        return m_error;
     }
-}
+
+private:
+    std::vector<Shape*>& m_shapes;
+    SceneArena& m_arena;
+    std::map<const SceneNode*, std::shared_ptr<const InstancePrototype>> m_prototypes;
+    std::string m_error;
+};
 
 bool SceneParser::parse(std::string filepath, RenderData &renderData) {
+    if (CompiledScene::isCompiled(filepath)) {
+        return CompiledScene::load(filepath, renderData);
+    }
+
     ScenefileReader fileReader = ScenefileReader(filepath);
-    bool success = fileReader.readXML();
+    renderData.shapes.clear();
+    renderData.arena = std::make_unique<SceneArena>();
+
+    // The shapes are made as the file is read, without building the scene graph first
+    ShapeBuilder builder(renderData.shapes, *renderData.arena);
+    bool success = fileReader.streamXML(builder);
+    if (success && !builder.error().empty()) {
+        std::cout << "could not build an SDF group: " << builder.error() << std::endl;
+        success = false;
+    }
     if (!success) {
+        renderData.shapes.clear();
+        renderData.arena.reset();
         return false;
     }
 
@@ -89,10 +126,5 @@ bool SceneParser::parse(std::string filepath, RenderData &renderData) {
     renderData.globalData = fileReader.getGlobalData();
     renderData.lights = fileReader.getLights();
 
-    SceneNode* root = fileReader.getRootNode();
-    renderData.shapes.clear();
-
-    traverseSceneGraph(root, glm::mat4(1), renderData.shapes, std::numeric_limits<float>::infinity());
-
     return true;
 }
@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include "raytracer/intersect.h"
+#include "scenearena.h"
 
 // Struct which contains data for a single primitive, to be used for rendering
 struct RenderShapeData {
@@ -19,7 +20,8 @@ struct RenderData {
     SceneCameraData cameraData;
 
     std::vector<SceneLightData> lights;
-    std::vector<Shape*> shapes;
+    std::vector<Shape*> shapes; // Owned by the arena
+    std::unique_ptr<SceneArena> arena;
     //std::vector<glm::vec3> positionPoints;
     //std::vector<glm::vec3>
 };
@@ -27,11 +29,14 @@ struct RenderData {
 class SceneParser {
 public:
     // Parse the scene and store the results in renderData.
-    // @param filepath    The path of the scene file to load.
+    // @param filepath    The path of the scene file to load, either a scene file or one compiled by CompiledScene.
     // @param renderData  On return, this will contain the metadata of the loaded scene.
     // @return            A boolean value indicating whether the parse was successful.
     static bool parse(std::string filepath, RenderData &renderData);
 };
 
-Shape* makeShape(ScenePrimitive& primative, glm::mat4 ctm);
+// Creates the shape for the primitive in the arena
+Shape* makeShape(SceneArena& arena, const ScenePrimitive& primative, glm::mat4 ctm);
+Shape* makeShape(SceneArena& arena, PrimitiveType type, FractalType fractalType, ShapeData data, glm::mat4 ctm);
+glm::mat4 transformationToMatrix(SceneTransformation transformation);
 
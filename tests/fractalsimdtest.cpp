@@ -0,0 +1,95 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+#include "shapes/fractal.h"
+#include "shapes/fractalsimd.h"
+
+// Compares the batched fractal SDFs (fractalsimd.cpp) with the scalar Fractal::*SDF functions they mirror, over
+// random points in and around each fractal's bounds.
+//
+// Each batched distance must be within RELATIVE_TOLERANCE of the scalar one, relative to the larger of the scalar
+// distance and DISTANCE_FLOOR (so points right on the surface are held to RELATIVE_TOLERANCE * DISTANCE_FLOOR).
+//
+// The mandelbulb's orbit is chaotic near the set: the scalar function does part of its arithmetic in double, and
+// each iteration multiplies that rounding difference by up to ~8, so past MANDELBULB_CHAOTIC_ITERATIONS the two
+// only agree on points at least DISTANCE_FLOOR from the surface. Closer points are skipped at those counts.
+
+const float RELATIVE_TOLERANCE = 1e-4f;
+const float DISTANCE_FLOOR = 0.1f;
+const int MANDELBULB_CHAOTIC_ITERATIONS = 8;
+
+// Counts that aren't multiples of the SIMD width, so the padded tail lanes are covered
+const int COUNTS[] = {1, 3, 5, 7, 13, 37, 1001};
+const int ITERATIONS[] = {1, 2, 3, 5, 8, 12, 20};
+
+// Written past the end of the output, to check the tail lanes aren't stored
+const float CANARY = -12345.0f;
+
+using BatchSDF = std::function<void(const glm::vec4*, float*, int, int)>;
+using ScalarSDF = std::function<float(const Fractal&, glm::vec4, int)>;
+
+static int testFractal(const char* name, FractalType type, BatchSDF batch, ScalarSDF scalar, std::mt19937& rng) {
+    Fractal fractal(ShapeData{nullptr}, glm::mat4(1), type);
+    float extent = fractal.boundingRadius() * 1.2f;
+    std::uniform_real_distribution<float> coordinate(-extent, extent);
+
+    int failures = 0;
+    for (int iterations : ITERATIONS) {
+        for (int count : COUNTS) {
+            std::vector<glm::vec4> points(count);
+            for (glm::vec4& point : points)
+                point = glm::vec4(coordinate(rng), coordinate(rng), coordinate(rng), 1.0f);
+
+            std::vector<float> out(count + 1, CANARY);
+            batch(points.data(), out.data(), count, iterations);
+            if (out[count] != CANARY) {
+                std::printf("%s: %d points, %d iterations wrote past the end of the output\n", name, count, iterations);
+                failures++;
+            }
+
+            for (int i = 0; i < count; i++) {
+                float expected = scalar(fractal, points[i], iterations);
+                if (type == FractalType::MANDELBULB && iterations > MANDELBULB_CHAOTIC_ITERATIONS &&
+                    std::abs(expected) < DISTANCE_FLOOR)
+                    continue;
+
+                float tolerance = RELATIVE_TOLERANCE * std::max(std::abs(expected), DISTANCE_FLOOR);
+                if (!(std::abs(out[i] - expected) <= tolerance)) {
+                    std::printf("%s: %d iterations, point %d of %d at (%g, %g, %g): batched %g, scalar %g\n",
+                                name, iterations, i, count, points[i].x, points[i].y, points[i].z, out[i], expected);
+                    failures++;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main() {
+#ifdef __AVX2__
+    // The AVX2 build of the test can't run on CPUs without it
+    if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("fma")) {
+        std::printf("Skipped: the CPU doesn't support AVX2 and FMA\n");
+        return 77;
+    }
+#endif
+
+    std::mt19937 rng(2024);
+    int failures = 0;
+    failures += testFractal("mandelbulb", FractalType::MANDELBULB, mandelbulbSDFBatch,
+                            [](const Fractal& f, glm::vec4 p, int n) { return f.mandelbulbSDF(p, n); }, rng);
+    failures += testFractal("mandelbox", FractalType::MANDELBOX, mandelboxSDFBatch,
+                            [](const Fractal& f, glm::vec4 p, int n) { return f.mandelboxSDF(p, n); }, rng);
+    failures += testFractal("serpinski", FractalType::SERPINSKI, serpinskiSDFBatch,
+                            [](const Fractal& f, glm::vec4 p, int n) { return f.serpinskiSDF(p, n); }, rng);
+
+    if (failures > 0) {
+        std::printf("%d mismatches with a SIMD width of %d\n", failures, fractalSIMDWidth());
+        return EXIT_FAILURE;
+    }
+    std::printf("All batched fractal SDFs match the scalar ones with a SIMD width of %d\n", fractalSIMDWidth());
+    return EXIT_SUCCESS;
+}